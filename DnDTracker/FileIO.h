@@ -92,11 +92,92 @@ std::string getSaveFileFromUser(std::vector<std::string> validExtensions){
 
 #elif defined(__linux__)
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #else
 #error No Mac
 #endif
 
+// Read-only memory mapping of a whole file. Not copyable: the mapping is
+// released when the object goes out of scope.
+struct MappedFile{
+    const unsigned char* data = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){
+        close();
+    }
+
+    bool open(std::string path){
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE){return false;}
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0){
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping == NULL){
+            close();
+            return false;
+        }
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(view == NULL){
+            close();
+            return false;
+        }
+        data = (const unsigned char*)view;
+        size = (size_t)fileSize.QuadPart;
+#else
+        file = ::open(path.c_str(), O_RDONLY);
+        if(file < 0){return false;}
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size <= 0){
+            close();
+            return false;
+        }
+        void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if(view == MAP_FAILED){
+            close();
+            return false;
+        }
+        data = (const unsigned char*)view;
+        size = info.st_size;
+#endif
+        return true;
+    }
+
+    void close(){
+#ifdef _WIN32
+        if(data != NULL){UnmapViewOfFile(data);}
+        if(mapping != NULL){CloseHandle(mapping);}
+        if(file != INVALID_HANDLE_VALUE){CloseHandle(file);}
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(data != NULL){munmap((void*)data, size);}
+        if(file >= 0){::close(file);}
+        file = -1;
+#endif
+        data = NULL;
+        size = 0;
+    }
+};
+
 
 
 
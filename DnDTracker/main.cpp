@@ -11,6 +11,12 @@ int main(int argc, char* argv[]){
 		return 1;
 	}
 
+#ifdef _DEBUG
+	if(!BackgroundResampler::isAreaAlignedWithLinear()){
+		LOG("area resampling does not line up with bilinear resampling");
+	}
+#endif
+
 	std::filesystem::path execDir = std::filesystem::absolute(std::filesystem::path(argv[0])).remove_filename();
 
 	Scene scene;
@@ -25,7 +31,7 @@ int main(int argc, char* argv[]){
 		std::cout << path << std::endl;
 		if(std::filesystem::exists(path)){
 			scene = Scene::sceneFromFile(path);
-			foundScene = true;
+			foundScene = !scene.levels.empty();
 		}
 	}
 
@@ -41,25 +47,28 @@ int main(int argc, char* argv[]){
 	LOG("Here 3333");
 	SDL_Event event;
 
-	int fpsc = 0;
-
-	std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+	Uint32 lastFrame = 0;
 	LOG("Here 44");
 	while(!scene.w.shouldQuit()){
-		while(SDL_PollEvent(&event)){
+		int timeout = scene.getEventTimeout(lastFrame);
+
+		if(timeout > 0 ? SDL_WaitEventTimeout(&event, timeout) : SDL_PollEvent(&event)){
+			scene.profiler.begin();
 			scene.handleEvent(event);
+			while(SDL_PollEvent(&event)){
+				scene.handleEvent(event);
+			}
+			scene.profiler.end(PHASE_EVENTS);
 		}
 		scene.updateGUI();
 
-		scene.render();
-		if(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()-ms.count() > 1000){
-			ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
-			std::cout << "fps: " << fpsc << std::endl;
-			fpsc = 0;
+		if(scene.needsRender() && SDL_GetTicks() - lastFrame >= scene.getFrameInterval()){
+			lastFrame = SDL_GetTicks();
+			scene.render();
 		}
-		fpsc++;
 	}
 
+	scene.shutdown();
 	SDL_DestroyWindow(scene.w.window);
 	SDL_Quit();
 
@@ -10,6 +10,18 @@
 #include <tuple>
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <list>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <functional>
 #include <string>
 #include "opencv2/opencv.hpp"
 
@@ -24,53 +36,348 @@
 
 #define LINE_SPACE 5
 
+#define PYRAMID_MIN_RES 256
+
+#define BACKGROUND_MODE_CPU 0
+#define BACKGROUND_MODE_TILED 1
+
+#define BACKGROUND_TILE_SIZE 512
+#define BACKGROUND_TEXTURE_GRANULARITY 256
+
+#define BACKGROUND_FAST_FILTER cv::INTER_NEAREST
+#define BACKGROUND_DEFAULT_FILTER cv::INTER_LINEAR
+#define BACKGROUND_QUALITY_FILTER cv::INTER_AREA
+#define REFINE_IDLE_MS 150
+
+#define MARKER_GRID_CELL_SIZE 256
+
+#define VIRTUAL_IMAGE_MAGIC "DNDTILE1"
+#define VIRTUAL_IMAGE_MIN_PIXELS (8192LL*8192LL)
+#define VIRTUAL_TILE_SIZE 512
+#define VIRTUAL_TILE_COMPRESSION 1
+#define VIRTUAL_TILE_CACHE_BYTES (256*1024*1024)
+#define VIRTUAL_HEADER_SIZE 36
+#define VIRTUAL_INDEX_ENTRY_SIZE 12
+#define VIRTUAL_MAX_LEVELS 32
+#define VIRTUAL_MAX_TILE_SIZE 8192
+#define VIRTUAL_COPY_CHUNK_BYTES (4*1024*1024)
+
+#define LEVEL_RESIDENCY_BUDGET ((size_t)512*1024*1024)
+#define LEVEL_EVICT_PNG_COMPRESSION 3
+#define LEVEL_IMAGE_READ_FLAGS cv::IMREAD_COLOR
+
 #define TEXT_BOX_COLOR Color(0, 255, 0)
 
+#define LABEL_FONT cv::FONT_HERSHEY_SIMPLEX
+#define LABEL_FONT_SCALE 0.5
+#define LABEL_FONT_THICKNESS 1
+
+#define MENU_FONT_SCALE 0.75
+#define MENU_FONT_THICKNESS 2
+
+#define GLYPH_FIRST 32
+#define GLYPH_LAST 126
+#define GLYPH_PADDING 2
+#define GLYPH_ATLAS_WIDTH 512
+
 #define OPTION_DELETE 1
 #define OPTION_RENAME 2
 #define OPTION_ADD_LEVEL 3
 #define OPTION_OPEN_LEVEL 4
 
-#define FILE_FORMAT_VERSION 10003
+#define PROFILER_WINDOW 240
+
+#define PHASE_EVENTS 0
+#define PHASE_UPDATE_GUI 1
+#define PHASE_BACKGROUND 2
+#define PHASE_MARKERS 3
+#define PHASE_GUI 4
+#define PHASE_PRESENT 5
+#define PHASE_COUNT 6
+
+#define DEFAULT_FRAME_CAP 60
+#define IDLE_WAIT_MS 500
+
+#define FILE_FORMAT_VERSION 20001
+// Every 1000x version before the v2 container shares the v1 layout.
+#define FILE_FORMAT_VERSION_V1_MIN 10000
+#define FILE_FORMAT_VERSION_V1 10003
+
+#define FILE_HEADER_SIZE 8
+#define SECTION_ENTRY_SIZE 20
+#define LEVEL_SECTION_COUNT 3
+#define SECTION_METADATA 0
+#define SECTION_MARKERS 1
+#define SECTION_IMAGE 2
+#define LEVEL_METADATA_SIZE 24
+#define BINARY_WRITER_BUFFER_SIZE (64*1024)
+
+// Fixed part of a marker record, in file order: position x/y, level link,
+// icon id, color, label color, label size. The label bytes follow it.
+#define MARKER_HEADER_SIZE (4 + 4 + 4 + 4 + 3 + 3 + 4)
+static_assert(MARKER_HEADER_SIZE == 26, "marker header layout is part of the file format");
+
+#define IMAGE_KIND_ENCODED 0
+#define IMAGE_KIND_VIRTUAL 1
 
 #define FILE_EXTENSION "dndt"
+#define SAVE_TEMP_SUFFIX ".tmp"
+#define SAVE_STATUS_MS 3000
+
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_MAGIC "DNDJRNL1"
+#define JOURNAL_HEADER_SIZE 20
+#define JOURNAL_FINGERPRINT_BYTES 65536
+#define JOURNAL_RECORD_SIZE 48
+#define JOURNAL_PAYLOAD_SIZE 20
+#define JOURNAL_COMPACT_RECORDS 1024
+
+#define JOURNAL_ADD_MARKER 1
+#define JOURNAL_MOVE_MARKER 2
+#define JOURNAL_RELABEL_MARKER 3
+#define JOURNAL_DELETE_MARKER 4
+#define JOURNAL_ADD_LEVEL 5
+#define JOURNAL_LINK_MARKER 6
 
 #define VALID_IMAGE_EXTENSIONS {"bmp", "dib", "jpeg", "jpg", "jpe", "jp2", "png", "webp", "pbm", "pgm", "ppm", "pxm", "pnm", "sr", "ras", "tiff", "tif", "exr", "hdr", "pic"}
 
-std::vector<unsigned char> intToBytes(int32_t x){
-	std::vector<unsigned char> buffer =  {};
-	buffer.push_back((x>>(8*0))&0xff);
-	buffer.push_back((x>>(8*1))&0xff);
-	buffer.push_back((x>>(8*2))&0xff);
-	buffer.push_back((x>>(8*3))&0xff);
-	return buffer;
+int intFromBytes(const unsigned char* bytes){
+	return (int32_t)((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
 }
 
 int intFromBytes(const std::vector<unsigned char>* bytes, int offset) {
-	int32_t result = 0;
-	for (int i = offset; i < 4 + offset; ++i) {
-		result |= static_cast<int32_t>(bytes->at(i)) << (8 * (i-offset));
-	}
-	return result;
+	if(offset < 0 || (size_t)offset + 4 > bytes->size()){return 0;}
+	return intFromBytes(bytes->data() + offset);
 }
 
 
-template <typename T>
+int64_t int64FromBytes(const std::vector<unsigned char>* bytes, int offset){
+	return (int64_t)((uint64_t)(uint32_t)intFromBytes(bytes, offset) | ((uint64_t)(uint32_t)intFromBytes(bytes, offset + 4) << 32));
+}
+
+std::vector<uint32_t> makeCrc32Table(){
+	std::vector<uint32_t> table(256);
+	for(uint32_t i = 0; i < 256; i++){
+		uint32_t c = i;
+		for(int k = 0; k < 8; k++){
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		table.at(i) = c;
+	}
+	return table;
+}
 
-void addVectors(std::vector<T>& a, std::vector<T> b){
-	for(int i = 0; i < b.size(); i++){
-		a.push_back(b.at(i));
+// Pass the previous result as crc to continue a checksum over several buffers.
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0){
+	// Function-local static: initialised once even when levels are loaded in parallel.
+	static const std::vector<uint32_t> table = makeCrc32Table();
+	crc ^= 0xFFFFFFFFu;
+	for(size_t i = 0; i < size; i++){
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
 	}
+	return crc ^ 0xFFFFFFFFu;
 }
 
-std::vector<unsigned char> stringToBytes(std::string x){
-	std::vector<unsigned char> data = {};
-	for(int i = 0; i < x.size(); i++){
-		data.push_back(x.at(i));
+// Runs job(0) .. job(jobCount-1) on up to one thread per core and returns
+// once all of them have finished. Jobs must not touch shared state.
+void parallelFor(int jobCount, std::function<void(int)> job){
+	int threadCount = std::min(jobCount, std::max(1, (int)std::thread::hardware_concurrency()));
+	std::atomic<int> next(0);
+	auto work = [&](){
+		for(int i = next++; i < jobCount; i = next++){job(i);}
+	};
+	std::vector<std::thread> threads = {};
+	for(int i = 1; i < threadCount; i++){
+		threads.push_back(std::thread(work));
+	}
+	work();
+	for(int i = 0; i < threads.size(); i++){
+		threads.at(i).join();
 	}
-	return data;
 }
 
+// Non-owning window over bytes that live elsewhere (a vector or a MappedFile).
+// Reads are bounds checked once per value; a read past the end returns 0 and
+// sets isOverrun so parsers can check for truncation once at the end.
+struct ByteView{
+	const unsigned char* data;
+	size_t size;
+	bool isOverrun;
+
+	ByteView(): data(NULL), size(0), isOverrun(false) {}
+	ByteView(const unsigned char* data, size_t size){
+		this->data = data;
+		this->size = size;
+		this->isOverrun = false;
+	}
+	ByteView(const std::vector<unsigned char>* bytes){
+		this->data = bytes->data();
+		this->size = bytes->size();
+		this->isOverrun = false;
+	}
+
+	bool contains(int64_t offset, int64_t length){
+		return offset >= 0 && length >= 0 && (uint64_t)offset <= size && (uint64_t)length <= size - offset;
+	}
+
+	ByteView slice(int64_t offset, int64_t length){
+		if(!contains(offset, length)){
+			isOverrun = true;
+			return ByteView();
+		}
+		return ByteView(data + offset, length);
+	}
+
+	unsigned char getByte(int64_t offset){
+		if(!contains(offset, 1)){
+			isOverrun = true;
+			return 0;
+		}
+		return data[offset];
+	}
+
+	int32_t getInt(int64_t offset){
+		if(!contains(offset, 4)){
+			isOverrun = true;
+			return 0;
+		}
+		return intFromBytes(data + offset);
+	}
+
+	int64_t getInt64(int64_t offset){
+		return (int64_t)((uint64_t)(uint32_t)getInt(offset) | ((uint64_t)(uint32_t)getInt(offset + 4) << 32));
+	}
+
+	std::string getString(int64_t offset, int64_t length){
+		ByteView bytes = slice(offset, length);
+		return std::string((const char*)bytes.data, bytes.size);
+	}
+
+	std::vector<unsigned char> toVector(){
+		return std::vector<unsigned char>(data, data + size);
+	}
+
+	// Wraps the bytes without copying, for cv::imdecode.
+	cv::Mat asMat(){
+		if(size == 0){return cv::Mat();}
+		return cv::Mat(1, (int)size, CV_8UC1, (void*)data);
+	}
+};
+
+// Buffered little-endian writer over a stream. Keeps the offset of the next
+// byte and a running crc32 of everything written since resetChecksum().
+// Without a stream the bytes collect in buffer for the owner to take.
+struct BinaryWriter{
+	std::ostream* stream;
+	std::vector<unsigned char> buffer;
+	int64_t offset;
+	uint32_t checksum;
+
+	BinaryWriter(std::ostream* stream){
+		this->stream = stream;
+		this->offset = 0;
+		this->checksum = 0;
+		if(stream != NULL){buffer.reserve(BINARY_WRITER_BUFFER_SIZE);}
+	}
+	~BinaryWriter(){
+		flush();
+	}
+
+	void putBytes(const unsigned char* data, size_t size){
+		checksum = crc32(data, size, checksum);
+		offset += size;
+		if(stream != NULL && buffer.size() + size > BINARY_WRITER_BUFFER_SIZE){flush();}
+		if(stream != NULL && size >= BINARY_WRITER_BUFFER_SIZE){
+			stream->write(reinterpret_cast<const char*>(data), size);
+			return;
+		}
+		buffer.insert(buffer.end(), data, data + size);
+	}
+
+	void putByte(unsigned char x){
+		putBytes(&x, 1);
+	}
+
+	void putInt(int32_t x){
+		unsigned char bytes[4] = {(unsigned char)(x & 0xff), (unsigned char)((x >> 8) & 0xff), (unsigned char)((x >> 16) & 0xff), (unsigned char)((x >> 24) & 0xff)};
+		putBytes(bytes, 4);
+	}
+
+	void putInt64(int64_t x){
+		putInt((int32_t)(x & 0xffffffff));
+		putInt((int32_t)(x >> 32));
+	}
+
+	void putString(const std::string& x){
+		putBytes(reinterpret_cast<const unsigned char*>(x.data()), x.size());
+	}
+
+	void resetChecksum(){
+		checksum = 0;
+	}
+
+	void seek(int64_t offset){
+		flush();
+		stream->seekp(offset);
+		this->offset = offset;
+	}
+
+	bool flush(){
+		if(stream == NULL){return true;}
+		if(!buffer.empty()){
+			stream->write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			buffer.clear();
+		}
+		return !stream->fail();
+	}
+};
+
+// Sequential little-endian reader over a ByteView. Reads past the end return
+// zeroes and leave isOverrun() set, like the view itself.
+struct BinaryReader{
+	ByteView data;
+	int64_t cursor;
+
+	BinaryReader(ByteView data, int64_t cursor = 0){
+		this->data = data;
+		this->cursor = cursor;
+	}
+
+	bool isOverrun(){
+		return data.isOverrun;
+	}
+
+	bool hasBytes(int64_t size){
+		return data.contains(cursor, size);
+	}
+
+	unsigned char getByte(){
+		cursor += 1;
+		return data.getByte(cursor - 1);
+	}
+
+	int32_t getInt(){
+		cursor += 4;
+		return data.getInt(cursor - 4);
+	}
+
+	int64_t getInt64(){
+		cursor += 8;
+		return data.getInt64(cursor - 8);
+	}
+
+	ByteView getBytes(int64_t size){
+		ByteView bytes = data.slice(cursor, size);
+		cursor += size;
+		return bytes;
+	}
+
+	std::string getString(int64_t size){
+		ByteView bytes = getBytes(size);
+		return std::string(reinterpret_cast<const char*>(bytes.data), bytes.size);
+	}
+};
+
 struct Coord{
 	float x;
 	float y;
@@ -94,10 +401,9 @@ struct CoordInt{
 		return CoordInt(x+other.x, y+other.y);
 	}
 
-	std::vector<unsigned char> getSaveData(){
-		std::vector<unsigned char> toReturn = intToBytes(x);
-		addVectors(toReturn, intToBytes(y));
-		return toReturn;
+	void writeSaveData(BinaryWriter* writer){
+		writer->putInt(x);
+		writer->putInt(y);
 	}
 };
 
@@ -157,15 +463,34 @@ struct Color{
 		this->g = g;
 		this->b = b;
 	}
-	std::vector<unsigned char> getSaveData(){
-		return std::vector<unsigned char> {r, g, b};
+	void writeSaveData(BinaryWriter* writer){
+		writer->putByte(r);
+		writer->putByte(g);
+		writer->putByte(b);
 	}
 
-	static Color fromBuffer(std::vector<unsigned char>* data, int offset){
-		return Color(data->at(offset), data->at(offset+1), data->at(offset+2));
+	static Color fromBuffer(BinaryReader* reader){
+		unsigned char r = reader->getByte();
+		unsigned char g = reader->getByte();
+		unsigned char b = reader->getByte();
+		return Color(r, g, b);
 	}
 };
 
+struct BackgroundView{
+	int pyramidLevel;
+	double xScale;
+	double yScale;
+	int originX;
+	int originY;
+	int width;
+	int height;
+	int sourceX;
+	int sourceY;
+
+	BackgroundView(): pyramidLevel(), xScale(1.0), yScale(1.0), originX(), originY(), width(), height(), sourceX(), sourceY() {}
+};
+
 struct Camera{
 	CoordInt position;
 	int width;
@@ -217,321 +542,907 @@ struct Camera{
 		return CoordInt(std::round(((float)coord.x/Xfactor)), std::round(((float)coord.y/Yfactor)));
 	}
 
-	cv::Mat getBackgroundImage(cv::Mat image){
-		cv::Mat ret;
-		cv::Mat im = image(cv::Rect(position.x, position.y, width, height));
-		cv::resize(im, ret, cv::Size(renderWidth, renderHeight), 0, 0);
-		return ret;
+	int getPyramidLevel(int levelCount){
+		float sourcePerPixel = std::min((float)width/(float)renderWidth, (float)height/(float)renderHeight);
+		int level = 0;
+		while(level+1 < levelCount && sourcePerPixel >= (float)(2 << level)){
+			level++;
+		}
+		return level;
+	}
+
+	BackgroundView getBackgroundView(std::vector<cv::Size> sizes){
+		BackgroundView view;
+		view.pyramidLevel = getPyramidLevel(sizes.size());
+		cv::Size image = sizes.at(view.pyramidLevel);
+		view.xScale = (double)getXScaleFactor()*(double)sizes.at(0).width/(double)image.width;
+		view.yScale = (double)getYScaleFactor()*(double)sizes.at(0).height/(double)image.height;
+		view.originX = std::round((double)position.x*getXScaleFactor());
+		view.originY = std::round((double)position.y*getYScaleFactor());
+		view.width = renderWidth;
+		view.height = renderHeight;
+		return view;
 	}
 
 };
 
-struct GuiToggleComponent{
-	CoordInt position;
+struct BackgroundResampler{
+	std::vector<int> xOffsets = {};
+	std::vector<int> xWeights = {};
+	std::vector<int> yOffsets = {};
+	std::vector<int> yWeights = {};
+	std::vector<int> columnSums = {};
+
+	BackgroundResampler() {}
+
+	void resample(cv::Mat* source, BackgroundView view, unsigned char* pixels, int pitch, int filter){
+		// Area averaging only differs from bilinear when minifying.
+		if(filter == cv::INTER_AREA && (view.xScale >= 1.0 || view.yScale >= 1.0)){filter = cv::INTER_LINEAR;}
+		if(source->channels() == 4){resampleChannels<4>(source, view, pixels, pitch, filter);}
+		else if(source->channels() == 3){resampleChannels<3>(source, view, pixels, pitch, filter);}
+		else{resampleChannels<1>(source, view, pixels, pitch, filter);}
+	}
 
-	Color color;
-	Color hoveringColor;
-	Color selectedColor;
-	cv::Mat* image;
-	bool isToggled = false;
+	// Splits the exact source span of each destination pixel into per source pixel
+	// coverage weights that sum to 256. Returns the number of taps per destination pixel.
+	static int getAreaTaps(int origin, int count, double scale, int sourceOrigin, int sourceSize, std::vector<int>* offsets, std::vector<int>* weights){
+		int taps = (int)std::ceil(1.0/scale) + 1;
+		offsets->resize((size_t)count*taps);
+		weights->resize((size_t)count*taps);
+		for(int i = 0; i < count; i++){
+			double start = (double)(origin + i)/scale - sourceOrigin;
+			double end = (double)(origin + i + 1)/scale - sourceOrigin;
+			int first = std::floor(start);
+			int previous = 0;
+			for(int t = 0; t < taps; t++){
+				double covered = std::max(0.0, std::min(end, (double)(first + t + 1)) - start);
+				int cumulative = std::min(256, (int)std::round(covered*scale*256.0));
+				offsets->at((size_t)i*taps + t) = std::max(0, std::min(first + t, sourceSize-1));
+				weights->at((size_t)i*taps + t) = cumulative - previous;
+				previous = cumulative;
+			}
+		}
+		return taps;
+	}
 
-	GuiToggleComponent(): position(), color(), hoveringColor(), selectedColor(), image() {}
-	GuiToggleComponent(CoordInt position, Color color, Color hoveringColor, Color selectedColor, cv::Mat* image){
-		this->position = position;
-		this->color = color;
-		this->hoveringColor = hoveringColor;
-		this->selectedColor = selectedColor;
-		this->image = image;
+	template <int channels>
+	void resampleArea(cv::Mat* source, BackgroundView view, unsigned char* pixels, int pitch){
+		if(view.width <= 0 || view.height <= 0){return;}
+		int xTaps = getAreaTaps(view.originX, view.width, view.xScale, view.sourceX, source->cols, &xOffsets, &xWeights);
+		int yTaps = getAreaTaps(view.originY, view.height, view.yScale, view.sourceY, source->rows, &yOffsets, &yWeights);
+		int firstColumn = xOffsets.front();
+		int span = (xOffsets.back() - firstColumn + 1)*channels;
+		for(int i = 0; i < xOffsets.size(); i++){
+			xOffsets[i] = (xOffsets[i] - firstColumn)*channels;
+		}
+		columnSums.resize(span);
+		for(int y = 0; y < view.height; y++){
+			std::fill(columnSums.begin(), columnSums.end(), 0);
+			for(int t = 0; t < yTaps; t++){
+				int wy = yWeights[(size_t)y*yTaps + t];
+				if(wy == 0){continue;}
+				const unsigned char* row = source->ptr(yOffsets[(size_t)y*yTaps + t]) + firstColumn*channels;
+				for(int i = 0; i < span; i++){
+					columnSums[i] += row[i]*wy;
+				}
+			}
+			unsigned char* out = pixels + (size_t)y*pitch;
+			for(int x = 0; x < view.width; x++){
+				int sums[3] = {0, 0, 0};
+				for(int t = 0; t < xTaps; t++){
+					int wx = xWeights[(size_t)x*xTaps + t];
+					const int* p = &columnSums[xOffsets[(size_t)x*xTaps + t]];
+					for(int c = 0; c < 3; c++){
+						sums[c] += p[channels >= 3 ? c : 0]*wx;
+					}
+				}
+				for(int c = 0; c < 3; c++){
+					out[4*x+c] = (sums[c] + 32768) >> 16;
+				}
+				out[4*x+3] = 255;
+			}
+		}
 	}
 
-	bool isInside(CoordInt pos){
-		if(pos.x < position.x){return false;}
-		if(pos.y < position.y){return false;}
-		if(pos.x > position.x+ICON_RES){return false;}
-		if(pos.y > position.y+ICON_RES){return false;}
-		return true;
+	// Renders a source with one vertical and one horizontal edge through both the area and
+	// the bilinear filter at a fractional zoom and checks both place the edges at the same spot.
+	static bool isAreaAlignedWithLinear(){
+		cv::Mat source = cv::Mat(64, 64, CV_8UC3);
+		for(int y = 0; y < source.rows; y++){
+			for(int x = 0; x < source.cols; x++){
+				cv::Vec3b* p = &source.at<cv::Vec3b>(y, x);
+				(*p)[0] = x >= 29 ? 255 : 0;
+				(*p)[1] = y >= 23 ? 255 : 0;
+				(*p)[2] = 0;
+			}
+		}
+		BackgroundView view;
+		view.xScale = 0.73;
+		view.yScale = 0.61;
+		view.originX = 3;
+		view.originY = 2;
+		view.width = 40;
+		view.height = 30;
+		cv::Mat area = cv::Mat(view.height, view.width, CV_8UC4);
+		cv::Mat linear = cv::Mat(view.height, view.width, CV_8UC4);
+		BackgroundResampler resampler;
+		resampler.resample(&source, view, area.data, area.step, cv::INTER_AREA);
+		resampler.resample(&source, view, linear.data, linear.step, cv::INTER_LINEAR);
+		// The summed brightness of a step edge is the number of pixels past it, so equal sums mean equal edge positions.
+		cv::Scalar areaSums = cv::sum(area);
+		cv::Scalar linearSums = cv::sum(linear);
+		double xShift = std::abs(areaSums[0] - linearSums[0])/(255.0*view.height);
+		double yShift = std::abs(areaSums[1] - linearSums[1])/(255.0*view.width);
+		return xShift <= 0.25 && yShift <= 0.25;
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture, bool isHovering){
-		SDL_UpdateTexture(texture, NULL, (*image).data,(*image).cols * (*image).channels());
-		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-		SDL_Rect rect = {position.x, position.y, ICON_RES, ICON_RES};
-		if(isHovering){
-			SDL_SetTextureColorMod(texture, hoveringColor.r, hoveringColor.g, hoveringColor.b);
+	template <int channels>
+	void resampleChannels(cv::Mat* source, BackgroundView view, unsigned char* pixels, int pitch, int filter){
+		if(filter == cv::INTER_AREA){
+			resampleArea<channels>(source, view, pixels, pitch);
+			return;
 		}
-		else if(isToggled){
-			SDL_SetTextureColorMod(texture, selectedColor.r, selectedColor.g, selectedColor.b);
+		if(filter == cv::INTER_NEAREST){
+			xOffsets.resize(view.width);
+			for(int x = 0; x < view.width; x++){
+				int sx = std::floor(((double)(view.originX + x) + 0.5)/view.xScale) - view.sourceX;
+				xOffsets.at(x) = std::max(0, std::min(sx, source->cols-1))*channels;
+			}
+			for(int y = 0; y < view.height; y++){
+				int sy = std::floor(((double)(view.originY + y) + 0.5)/view.yScale) - view.sourceY;
+				const unsigned char* row = source->ptr(std::max(0, std::min(sy, source->rows-1)));
+				unsigned char* out = pixels + (size_t)y*pitch;
+				for(int x = 0; x < view.width; x++){
+					const unsigned char* p = row + xOffsets[x];
+					out[4*x] = p[0];
+					out[4*x+1] = p[channels >= 3 ? 1 : 0];
+					out[4*x+2] = p[channels >= 3 ? 2 : 0];
+					out[4*x+3] = 255;
+				}
+			}
+			return;
 		}
-		else{
-			SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+
+		xOffsets.resize(2*view.width);
+		xWeights.resize(view.width);
+		for(int x = 0; x < view.width; x++){
+			double fx = ((double)(view.originX + x) + 0.5)/view.xScale - 0.5 - view.sourceX;
+			int x0 = std::floor(fx);
+			int weight = std::round((fx - x0)*256.0);
+			int x1 = std::max(0, std::min(x0+1, source->cols-1));
+			x0 = std::max(0, std::min(x0, source->cols-1));
+			xOffsets.at(2*x) = x0*channels;
+			xOffsets.at(2*x+1) = x1*channels;
+			xWeights.at(x) = weight;
+		}
+		for(int y = 0; y < view.height; y++){
+			double fy = ((double)(view.originY + y) + 0.5)/view.yScale - 0.5 - view.sourceY;
+			int y0 = std::floor(fy);
+			int wy = std::round((fy - y0)*256.0);
+			const unsigned char* top = source->ptr(std::max(0, std::min(y0, source->rows-1)));
+			const unsigned char* bottom = source->ptr(std::max(0, std::min(y0+1, source->rows-1)));
+			unsigned char* out = pixels + (size_t)y*pitch;
+			for(int x = 0; x < view.width; x++){
+				int wx = xWeights[x];
+				const unsigned char* p00 = top + xOffsets[2*x];
+				const unsigned char* p01 = top + xOffsets[2*x+1];
+				const unsigned char* p10 = bottom + xOffsets[2*x];
+				const unsigned char* p11 = bottom + xOffsets[2*x+1];
+				for(int c = 0; c < 3; c++){
+					int sc = channels >= 3 ? c : 0;
+					int upper = p00[sc]*(256-wx) + p01[sc]*wx;
+					int lower = p10[sc]*(256-wx) + p11[sc]*wx;
+					out[4*x+c] = (upper*(256-wy) + lower*wy + 32768) >> 16;
+				}
+				out[4*x+3] = 255;
+			}
 		}
-		SDL_RenderCopy(renderer, texture, NULL, &rect);
-		SDL_SetTextureColorMod(texture, 255, 255, 255);
-	}
-	void toggle(){
-		isToggled = !isToggled;
 	}
-
 };
 
-struct MenuOption{
-	Color textColor;
-	Color backgroundColor;
+struct TileCache{
+	size_t budgetBytes;
+	size_t usedBytes = 0;
+	std::list<int> order = {};
+	std::unordered_map<int, std::pair<cv::Mat, std::list<int>::iterator>> entries;
 
-	cv::Mat textImage;
-	bool isEnabled = true;
+	TileCache(): budgetBytes(VIRTUAL_TILE_CACHE_BYTES) {}
+	TileCache(size_t budgetBytes){
+		this->budgetBytes = budgetBytes;
+	}
 
-	std::string name;
-	int width;
-	int height;
+	bool get(int key, cv::Mat* tile){
+		std::unordered_map<int, std::pair<cv::Mat, std::list<int>::iterator>>::iterator it = entries.find(key);
+		if(it == entries.end()){return false;}
+		order.splice(order.begin(), order, it->second.second);
+		*tile = it->second.first;
+		return true;
+	}
 
-	int optionType;
+	void put(int key, cv::Mat tile){
+		order.push_front(key);
+		entries[key] = std::make_pair(tile, order.begin());
+		usedBytes += tile.total()*tile.elemSize();
+		while(usedBytes > budgetBytes && order.size() > 1){
+			std::unordered_map<int, std::pair<cv::Mat, std::list<int>::iterator>>::iterator it = entries.find(order.back());
+			usedBytes -= it->second.first.total()*it->second.first.elemSize();
+			entries.erase(it);
+			order.pop_back();
+		}
+	}
 
-	MenuOption(): textColor(), backgroundColor(), name(), width(), height() {}
-	MenuOption(int width, int height, std::string name, Color textColor, Color backgroundColor, int optionType,bool isEnabled = true){
-		this->width = width;
-		this->height = height;
-		this->name = name;
-		this->textColor = textColor;
-		this->backgroundColor = backgroundColor;
-		this->isEnabled = isEnabled;
-		this->optionType = optionType;
-		updateName(name);
+	void clear(){
+		order.clear();
+		entries.clear();
+		usedBytes = 0;
 	}
+};
 
-	void updateName(std::string name){
-		this->name = name;
-		textImage = cv::Mat(MENU_OPTIONHEIGHT, MENU_OPTIONWIDTH, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-		cv::putText(textImage, name, cv::Point(0, MENU_OPTIONHEIGHT-5), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar(255, 255, 255, 255), 2, 8, false);
+struct VirtualImage{
+	std::string path;
+	int64_t baseOffset = 0;
+	int64_t sectionSize = -1;
+	bool isTemporary = false;
+
+	int width = 0;
+	int height = 0;
+	int tileSize = VIRTUAL_TILE_SIZE;
+	int channels = 3;
+	int64_t storeSize = 0;
+	std::vector<cv::Size> levelSizes = {};
+	std::vector<int> levelFirstTile = {};
+	std::vector<int64_t> tileOffsets = {};
+	std::vector<int> tileSizes = {};
+
+	TileCache cache;
+	std::ifstream file;
+	std::mutex mutex;
+
+	VirtualImage() {}
+	~VirtualImage(){
+		file.close();
+		if(isTemporary){
+			std::error_code error;
+			std::filesystem::remove(path, error);
+		}
 	}
 
-	bool isInsde(CoordInt position, CoordInt pos, int Yoffset){
-		if(!isEnabled){return false;}
-		if(pos.x < position.x){return false;}
-		if(pos.y < position.y+Yoffset){return false;}
-		if(pos.x > position.x+width){return false;}
-		if(pos.y > position.y+Yoffset+height){return false;}
-		return true;
+	static bool isStore(ByteView* data, int64_t offset, int64_t size){
+		if(size < VIRTUAL_HEADER_SIZE || !data->contains(offset, 8)){return false;}
+		return std::memcmp(data->data + offset, VIRTUAL_IMAGE_MAGIC, 8) == 0;
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture, CoordInt position, int Yoffset){
-		SDL_UpdateTexture(texture, NULL, textImage.data, textImage.cols * textImage.channels());
-		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-		SDL_Rect rect = {position.x, position.y+Yoffset, MENU_OPTIONWIDTH, MENU_OPTIONHEIGHT};
-		SDL_SetRenderDrawColor(renderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, 255);
-		SDL_RenderFillRect(renderer, &rect);
-		SDL_SetTextureColorMod(texture, textColor.r, textColor.g, textColor.b);
-		SDL_RenderCopy(renderer, texture, NULL, &rect);
-		SDL_SetTextureColorMod(texture, 255, 255, 255);
+	static std::string getTemporaryPath(){
+		static int counter = 0;
+		counter++;
+		std::string name = "dndtracker_" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "_" + std::to_string(counter) + ".dndtiles";
+		return (std::filesystem::temp_directory_path() / name).string();
 	}
 
-};
+	// sectionSize bounds the store inside a campaign file; -1 means up to the end of the file.
+	static std::shared_ptr<VirtualImage> open(std::string path, int64_t offset, int64_t sectionSize = -1){
+		std::shared_ptr<VirtualImage> image = std::make_shared<VirtualImage>();
+		image->path = path;
+		image->baseOffset = offset;
+		image->sectionSize = sectionSize;
+		if(!image->readIndex()){return NULL;}
+		return image;
+	}
 
-struct LeftCLickMenu{
-	CoordInt position;
-	std::vector<MenuOption> options;
+	static std::shared_ptr<VirtualImage> build(cv::Mat image, std::string path){
+		std::ofstream out(path, std::ios::binary);
+		if(!out){return NULL;}
 
-	LeftCLickMenu(): position() {}
-	LeftCLickMenu(CoordInt position){
-		this->position = position;
-	}
+		std::vector<cv::Size> sizes = {image.size()};
+		while(std::min(sizes.back().width, sizes.back().height)/2 >= PYRAMID_MIN_RES){
+			sizes.push_back(cv::Size((sizes.back().width + 1)/2, (sizes.back().height + 1)/2));
+		}
 
-	int getOption(CoordInt pos){
+		BinaryWriter writer = BinaryWriter(&out);
+		writer.putString(VIRTUAL_IMAGE_MAGIC);
+		writer.putInt(image.cols);
+		writer.putInt(image.rows);
+		writer.putInt(VIRTUAL_TILE_SIZE);
+		writer.putInt(image.channels());
+		writer.putInt(sizes.size());
+		int64_t indexOffsetPosition = writer.offset;
+		writer.putInt64(0);
+		for(int l = 0; l < sizes.size(); l++){
+			writer.putInt(sizes.at(l).width);
+			writer.putInt(sizes.at(l).height);
+		}
 
-		int Yoffset = 0;
-		for(int i = 0; i < options.size(); i++){
-			if(options.at(i).isInsde(position, pos, Yoffset)){
-				return i;
+		std::vector<int64_t> tileOffsets = {};
+		std::vector<int> tileSizes = {};
+		cv::Mat level = image;
+		for(int l = 0; l < sizes.size(); l++){
+			if(l > 0){
+				cv::Mat half;
+				cv::pyrDown(level, half);
+				level = half;
 			}
-			if(options.at(i).isEnabled){
-				Yoffset += options.at(i).height;
+			for(int ty = 0; ty*VIRTUAL_TILE_SIZE < level.rows; ty++){
+				for(int tx = 0; tx*VIRTUAL_TILE_SIZE < level.cols; tx++){
+					cv::Rect rect = cv::Rect(tx*VIRTUAL_TILE_SIZE, ty*VIRTUAL_TILE_SIZE, std::min(VIRTUAL_TILE_SIZE, level.cols - tx*VIRTUAL_TILE_SIZE), std::min(VIRTUAL_TILE_SIZE, level.rows - ty*VIRTUAL_TILE_SIZE));
+					std::vector<unsigned char> encoded = {};
+					cv::imencode(".png", level(rect), encoded, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, VIRTUAL_TILE_COMPRESSION});
+					tileOffsets.push_back(writer.offset);
+					tileSizes.push_back(encoded.size());
+					writer.putBytes(encoded.data(), encoded.size());
+				}
 			}
 		}
-		return -1;
+		int64_t indexOffset = writer.offset;
+		for(int i = 0; i < tileOffsets.size(); i++){
+			writer.putInt64(tileOffsets.at(i));
+			writer.putInt(tileSizes.at(i));
+		}
+
+		writer.seek(indexOffsetPosition);
+		writer.putInt64(indexOffset);
+		if(!writer.flush()){return NULL;}
+		out.close();
+		if(!out){return NULL;}
+
+		std::shared_ptr<VirtualImage> store = open(path, 0);
+		if(store != NULL){store->isTemporary = true;}
+		return store;
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture){
-		int Yoffset = 0;
-		for(int i = 0; i < options.size(); i++){
-			if(options.at(i).isEnabled){
-				options.at(i).render(renderer, texture, position, Yoffset);
-				Yoffset += options.at(i).height;
-			}
+	std::vector<unsigned char> readBytes(int64_t offset, int64_t size){
+		std::vector<unsigned char> data(size);
+		file.seekg(baseOffset + offset);
+		file.read(reinterpret_cast<char*>(data.data()), size);
+		if(file.gcount() != size){
+			data.clear();
+			file.clear();
 		}
+		return data;
 	}
 
-	void addOption(MenuOption option){
-		options.push_back(option);
+	// (Re)opens the store and loads its index. The new index is parsed into
+	// locals and swapped in at the end, so callers must hold mutex once the
+	// store is shared with the background worker.
+	bool readIndex(){
+		file.close();
+		file.clear();
+		file.open(path, std::ios::binary);
+		if(!file.is_open()){return false;}
+		file.seekg(0, std::ios::end);
+		int64_t available = (int64_t)file.tellg() - baseOffset;
+		if(sectionSize >= 0){available = std::min(available, sectionSize);}
+
+		// Every count and offset below comes from the file, so each one is checked
+		// against the bytes actually available before anything is allocated from it.
+		std::vector<unsigned char> header = readBytes(0, VIRTUAL_HEADER_SIZE);
+		if(available < VIRTUAL_HEADER_SIZE || header.size() != VIRTUAL_HEADER_SIZE || std::memcmp(header.data(), VIRTUAL_IMAGE_MAGIC, 8) != 0){return false;}
+		int newTileSize = intFromBytes(&header, 16);
+		int newChannels = intFromBytes(&header, 20);
+		int levelCount = intFromBytes(&header, 24);
+		int64_t indexOffset = int64FromBytes(&header, 28);
+		if(newTileSize <= 0 || newTileSize > VIRTUAL_MAX_TILE_SIZE || newChannels < 1 || newChannels > 4){return false;}
+		if(levelCount <= 0 || levelCount > VIRTUAL_MAX_LEVELS || VIRTUAL_HEADER_SIZE + (int64_t)levelCount*8 > available){return false;}
+
+		std::vector<unsigned char> sizes = readBytes(VIRTUAL_HEADER_SIZE, (int64_t)levelCount*8);
+		if(sizes.size() != (size_t)levelCount*8){return false;}
+		std::vector<cv::Size> newLevelSizes = {};
+		std::vector<int> newLevelFirstTile = {};
+		int64_t tileCount = 0;
+		for(int l = 0; l < levelCount; l++){
+			cv::Size size = cv::Size(intFromBytes(&sizes, 8*l), intFromBytes(&sizes, 8*l + 4));
+			if(size.width <= 0 || size.height <= 0){return false;}
+			newLevelSizes.push_back(size);
+			newLevelFirstTile.push_back(tileCount);
+			int64_t levelTiles = (int64_t)((size.width + newTileSize - 1)/newTileSize)*((size.height + newTileSize - 1)/newTileSize);
+			if(levelTiles > available/VIRTUAL_INDEX_ENTRY_SIZE - tileCount){return false;}
+			tileCount += levelTiles;
+		}
+		if(indexOffset < 0 || indexOffset + tileCount*VIRTUAL_INDEX_ENTRY_SIZE > available){return false;}
+
+		std::vector<unsigned char> index = readBytes(indexOffset, tileCount*VIRTUAL_INDEX_ENTRY_SIZE);
+		if(index.size() != (size_t)tileCount*VIRTUAL_INDEX_ENTRY_SIZE){return false;}
+		std::vector<int64_t> newTileOffsets(tileCount);
+		std::vector<int> newTileSizes(tileCount);
+		for(int i = 0; i < tileCount; i++){
+			newTileOffsets.at(i) = int64FromBytes(&index, i*VIRTUAL_INDEX_ENTRY_SIZE);
+			newTileSizes.at(i) = intFromBytes(&index, i*VIRTUAL_INDEX_ENTRY_SIZE + 8);
+			if(newTileOffsets.at(i) < 0 || newTileSizes.at(i) < 0 || newTileOffsets.at(i) + newTileSizes.at(i) > indexOffset){return false;}
+		}
+
+		width = intFromBytes(&header, 8);
+		height = intFromBytes(&header, 12);
+		tileSize = newTileSize;
+		channels = newChannels;
+		levelSizes.swap(newLevelSizes);
+		levelFirstTile.swap(newLevelFirstTile);
+		tileOffsets.swap(newTileOffsets);
+		tileSizes.swap(newTileSizes);
+		storeSize = indexOffset + (int64_t)tileCount*VIRTUAL_INDEX_ENTRY_SIZE;
+		cache.clear();
+		return true;
 	}
 
-};
+	void relocate(std::string path, int64_t offset){
+		std::lock_guard<std::mutex> lock(mutex);
+		relocateLocked(path, offset);
+	}
 
-struct Marker{
-	CoordInt position;
-	Color color;
-	Color labelColor;
-	std::string label;
-	int iconId;
-	int hitbox_size;
+	void relocateLocked(std::string path, int64_t offset){
+		std::string previousPath = this->path;
+		bool wasTemporary = isTemporary;
+		this->path = path;
+		baseOffset = offset;
+		sectionSize = storeSize;
+		isTemporary = false;
+		readIndex();
+		if(wasTemporary){
+			std::error_code error;
+			std::filesystem::remove(previousPath, error);
+		}
+	}
 
-	int levelLink = -1;
+	// Copies the whole store into writer without holding more than one chunk in memory.
+	bool writeSaveData(BinaryWriter* writer){
+		std::lock_guard<std::mutex> lock(mutex);
+		for(int64_t offset = 0; offset < storeSize; offset += VIRTUAL_COPY_CHUNK_BYTES){
+			std::vector<unsigned char> chunk = readBytes(offset, std::min((int64_t)VIRTUAL_COPY_CHUNK_BYTES, storeSize - offset));
+			if(chunk.empty()){return false;}
+			writer->putBytes(chunk.data(), chunk.size());
+		}
+		return true;
+	}
 
-	cv::Mat textImage;
+	int getWidth(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return width;
+	}
 
-	Marker(): position(), color(), labelColor(), iconId(), label() {};
-	Marker(CoordInt position, Color color, Color labelColor, std::string label, int iconIndex, int hitbox_size){
-		this->position = position;
-		this->color = color;
-		this->labelColor = labelColor;
-		this->iconId = iconIndex;
-		this->hitbox_size = hitbox_size;
+	int getHeight(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return height;
+	}
 
-		UpdateLabel(label);
+	std::vector<cv::Size> getLevelSizes(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return levelSizes;
 	}
 
-	void UpdateLabel(std::string label){
-		this->label = label;
-		textImage = cv::Mat(TEXT_HEIGHT, TEXT_WIDTH, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+	int getColumns(int level){
+		return (levelSizes.at(level).width + tileSize - 1)/tileSize;
+	}
 
-		std::vector<std::string> lines;
-		std::string currentLine = "";
-
-		cv::Size textSize;
-		int baseline;
-		int lastSplitIndex = 0;
+	int getRows(int level){
+		return (levelSizes.at(level).height + tileSize - 1)/tileSize;
+	}
 
-		for(int i = 0; i < label.length(); i++){
-			currentLine += label.at(i);
-			textSize = cv::getTextSize(currentLine, cv::FONT_HERSHEY_SIMPLEX, 0.5, 1, &baseline);
+	cv::Mat getTile(int level, int tx, int ty){
+		std::lock_guard<std::mutex> lock(mutex);
+		if(level < 0 || level >= levelSizes.size() || tx < 0 || ty < 0 || tx >= getColumns(level) || ty >= getRows(level)){return cv::Mat();}
+		int key = levelFirstTile.at(level) + ty*getColumns(level) + tx;
+		cv::Mat tile;
+		if(cache.get(key, &tile)){return tile;}
+		std::vector<unsigned char> encoded = readBytes(tileOffsets.at(key), tileSizes.at(key));
+		if(!encoded.empty()){tile = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);}
+		if(!tile.empty()){cache.put(key, tile);}
+		return tile;
+	}
 
-			if(textSize.width > TEXT_WIDTH || (i == 0 ? false : label.at(i-1) == '\n') ){
-				if(currentLine.length() != 0){
-					currentLine.pop_back();
-					if(i == 0 ? false : label.at(i-1) == '\n'){
-						currentLine.pop_back();
-					}
-					lines.push_back(currentLine);
-					lastSplitIndex = i;
-				}
-				currentLine = label.at(i);
+	cv::Mat getRegion(int level, cv::Rect rect){
+		int tileSize, channels;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tileSize = this->tileSize;
+			channels = this->channels;
+		}
+		cv::Mat region = cv::Mat(rect.height, rect.width, CV_8UC(channels), cv::Scalar(0, 0, 0, 0));
+		for(int ty = rect.y/tileSize; ty <= (rect.y + rect.height - 1)/tileSize; ty++){
+			for(int tx = rect.x/tileSize; tx <= (rect.x + rect.width - 1)/tileSize; tx++){
+				cv::Mat tile = getTile(level, tx, ty);
+				if(tile.empty()){continue;}
+				cv::Rect overlap = cv::Rect(tx*tileSize, ty*tileSize, tile.cols, tile.rows) & rect;
+				if(overlap.empty()){continue;}
+				tile(cv::Rect(overlap.x - tx*tileSize, overlap.y - ty*tileSize, overlap.width, overlap.height))
+					.copyTo(region(cv::Rect(overlap.x - rect.x, overlap.y - rect.y, overlap.width, overlap.height)));
 			}
 		}
+		return region;
+	}
+
+	cv::Mat getViewRegion(BackgroundView* view){
+		cv::Size size;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(view->pyramidLevel < 0 || view->pyramidLevel >= levelSizes.size()){return cv::Mat();}
+			size = levelSizes.at(view->pyramidLevel);
+		}
+		int left = std::floor((double)view->originX/view->xScale) - 1;
+		int top = std::floor((double)view->originY/view->yScale) - 1;
+		int right = std::ceil((double)(view->originX + view->width)/view->xScale) + 1;
+		int bottom = std::ceil((double)(view->originY + view->height)/view->yScale) + 1;
+		left = std::max(0, std::min(left, size.width-1));
+		top = std::max(0, std::min(top, size.height-1));
+		right = std::max(left+1, std::min(right, size.width));
+		bottom = std::max(top+1, std::min(bottom, size.height));
+		view->sourceX = left;
+		view->sourceY = top;
+		return getRegion(view->pyramidLevel, cv::Rect(left, top, right-left, bottom-top));
+	}
+};
+
+struct BackgroundRequest{
+	cv::Mat source;
+	std::shared_ptr<VirtualImage> virtualImage;
+	BackgroundView view;
+	Camera camera;
+	int filter;
+	int level;
+	bool allowScrollReuse = false;
+
+	BackgroundRequest(): source(), virtualImage(), view(), camera(), filter(), level(-1) {}
+	BackgroundRequest(cv::Mat source, std::shared_ptr<VirtualImage> virtualImage, BackgroundView view, Camera camera, int filter, int level, bool allowScrollReuse){
+		this->source = source;
+		this->virtualImage = virtualImage;
+		this->view = view;
+		this->camera = camera;
+		this->filter = filter;
+		this->level = level;
+		this->allowScrollReuse = allowScrollReuse;
+	}
+
+	const void* getSourceKey(){
+		if(virtualImage != NULL){return virtualImage.get();}
+		return source.data;
+	}
+
+	void resolveSource(){
+		if(virtualImage != NULL){source = virtualImage->getViewRegion(&view);}
+	}
+
+	bool canScrollFrom(BackgroundRequest* previous){
+		if(filter == cv::INTER_AREA || filter != previous->filter){return false;}
+		if(getSourceKey() != previous->getSourceKey() || level != previous->level){return false;}
+		if(view.pyramidLevel != previous->view.pyramidLevel || view.xScale != previous->view.xScale || view.yScale != previous->view.yScale){return false;}
+		if(view.width != previous->view.width || view.height != previous->view.height){return false;}
+		return std::abs(view.originX - previous->view.originX) < view.width && std::abs(view.originY - previous->view.originY) < view.height;
+	}
+
+	bool isSameAs(BackgroundRequest* other){
+		return getSourceKey() == other->getSourceKey() && level == other->level && filter == other->filter
+			&& view.pyramidLevel == other->view.pyramidLevel && view.xScale == other->view.xScale && view.yScale == other->view.yScale
+			&& view.originX == other->view.originX && view.originY == other->view.originY
+			&& view.width == other->view.width && view.height == other->view.height;
+	}
+
+	SDL_FRect getDestination(Camera* current){
+		float xFactor = current->getXScaleFactor()/camera.getXScaleFactor();
+		float yFactor = current->getYScaleFactor()/camera.getYScaleFactor();
+		return SDL_FRect{
+			((float)view.originX/camera.getXScaleFactor() - (float)current->position.x)*current->getXScaleFactor(),
+			((float)view.originY/camera.getYScaleFactor() - (float)current->position.y)*current->getYScaleFactor(),
+			(float)view.width*xFactor,
+			(float)view.height*yFactor
+		};
+	}
+};
+
+struct BackgroundFrame{
+	cv::Mat pixels;
+	BackgroundRequest request;
+
+	BackgroundFrame(): pixels(), request() {}
+};
+
+struct BackgroundWorker{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool isRunning = false;
+	bool hasRequest = false;
+	bool hasNewFrame = false;
+	Uint32 frameEventType = 0;
+
+	BackgroundRequest pending;
+	std::vector<BackgroundFrame> frames = std::vector<BackgroundFrame>(2);
+	int frontIndex = 0;
+	BackgroundResampler resampler;
+
+	BackgroundWorker() {}
+	~BackgroundWorker(){
+		stop();
+	}
+
+	void start(Uint32 frameEventType){
+		this->frameEventType = frameEventType;
+		isRunning = true;
+		thread = std::thread(&BackgroundWorker::run, this);
+	}
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isRunning = false;
+		}
+		condition.notify_all();
+		if(thread.joinable()){thread.join();}
+	}
+
+	void submit(BackgroundRequest request){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = request;
+			hasRequest = true;
+		}
+		condition.notify_one();
+	}
+
+	void run(){
+		while(true){
+			BackgroundRequest request;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]{return hasRequest || !isRunning;});
+				if(!isRunning){return;}
+				request = pending;
+				pending = BackgroundRequest();
+				hasRequest = false;
+			}
+
+			request.resolveSource();
+			if(request.source.empty()){continue;}
+			BackgroundFrame* back = &frames.at(1-frontIndex);
+			BackgroundFrame* front = &frames.at(frontIndex);
+			back->pixels.create(request.view.height, request.view.width, CV_8UC4);
+			if(request.allowScrollReuse && !front->pixels.empty() && request.canScrollFrom(&front->request)){
+				scroll(front, back, &request);
+			}
+			else{
+				resampler.resample(&request.source, request.view, back->pixels.data, back->pixels.step, request.filter);
+			}
+			back->request = request;
 
-		currentLine = label.substr(lastSplitIndex);
-		if(currentLine.length() != 0){
-			lines.push_back(currentLine);
-			if((label.size() == 0 ? false : label.at(label.size()-1) == '\n')){
-				lines.at(lines.size()-1).pop_back();
-				lines.push_back("");
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				frontIndex = 1-frontIndex;
+				hasNewFrame = true;
 			}
+
+			SDL_Event event;
+			SDL_zero(event);
+			event.type = frameEventType;
+			SDL_PushEvent(&event);
 		}
+	}
+
+	void resampleRegion(BackgroundFrame* frame, BackgroundRequest* request, int x, int y, int width, int height){
+		if(width <= 0 || height <= 0){return;}
+		BackgroundView region = request->view;
+		region.originX += x;
+		region.originY += y;
+		region.width = width;
+		region.height = height;
+		resampler.resample(&request->source, region, frame->pixels.ptr(y) + x*4, frame->pixels.step, request->filter);
+	}
 
-		cv::Point point;
-		int lineCount = lines.size();
+	void scroll(BackgroundFrame* previous, BackgroundFrame* frame, BackgroundRequest* request){
+		int dx = request->view.originX - previous->request.view.originX;
+		int dy = request->view.originY - previous->request.view.originY;
+		int width = request->view.width;
+		int height = request->view.height;
+		int left = std::max(0, -dx);
+		int right = std::min(width, width - dx);
+		int top = std::max(0, -dy);
+		int bottom = std::min(height, height - dy);
+
+		for(int y = top; y < bottom; y++){
+			std::memcpy(frame->pixels.ptr(y) + left*4, previous->pixels.ptr(y + dy) + (left + dx)*4, (size_t)(right - left)*4);
+		}
 
-		for(int i = 0; i < lineCount; i++){
-			textSize = cv::getTextSize(lines.at(i), cv::FONT_HERSHEY_SIMPLEX, 0.5, 1, &baseline);
-			point = cv::Point(
-				(TEXT_WIDTH/2)-(textSize.width/2),
-				TEXT_HEIGHT - ((lineCount-i)*textSize.height + (lineCount-i-1)*LINE_SPACE)
-			);
+		resampleRegion(frame, request, 0, 0, width, top);
+		resampleRegion(frame, request, 0, bottom, width, height - bottom);
+		resampleRegion(frame, request, 0, top, left, bottom - top);
+		resampleRegion(frame, request, right, top, width - right, bottom - top);
+	}
 
-			cv::putText(textImage, lines.at(i), point, cv::FONT_HERSHEY_SIMPLEX, 0.5f, cv::Scalar(255, 255, 255, 255), 1, 8, false);
+	size_t uploadNewFrame(SDL_Texture* texture, int textureWidth, int textureHeight, BackgroundRequest* displayed){
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!hasNewFrame){return 0;}
+		hasNewFrame = false;
+
+		BackgroundFrame* front = &frames.at(frontIndex);
+		int width = std::min(front->pixels.cols, textureWidth);
+		int height = std::min(front->pixels.rows, textureHeight);
+		SDL_Rect rect = {0, 0, width, height};
+		void* pixels;
+		int pitch;
+		if(SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0){return 0;}
+		for(int y = 0; y < height; y++){
+			std::memcpy((unsigned char*)pixels + (size_t)y*pitch, front->pixels.ptr(y), (size_t)width*4);
 		}
+		SDL_UnlockTexture(texture);
 
+		*displayed = front->request;
+		displayed->view.width = width;
+		displayed->view.height = height;
+		return (size_t)width*height*4;
 	}
+};
 
-	bool isVisible(Camera* camera){
-		return true;
+struct QuadBatch{
+	std::vector<SDL_Vertex> vertices = {};
+	std::vector<int> indices = {};
+	int textureWidth;
+	int textureHeight;
 
-		//TODO: do not render unseen markers;
+	QuadBatch(): textureWidth(1), textureHeight(1) {}
+	QuadBatch(int textureWidth, int textureHeight){
+		this->textureWidth = textureWidth;
+		this->textureHeight = textureHeight;
 	}
 
-	std::vector<unsigned char> getSaveData(){
-		std::vector<unsigned char> saveData = {};
-		addVectors(saveData, position.getSaveData());
-		addVectors(saveData, intToBytes(levelLink));
-		addVectors(saveData, intToBytes(iconId));
-		addVectors(saveData, color.getSaveData());
-		addVectors(saveData, labelColor.getSaveData());
-		addVectors(saveData, intToBytes(label.size()));
-		addVectors(saveData, stringToBytes(label));
-		return saveData;
+	void add(SDL_FRect rect, SDL_Rect source, Color color, unsigned char alpha = 255){
+		float u0 = (float)source.x/(float)textureWidth;
+		float v0 = (float)source.y/(float)textureHeight;
+		float u1 = (float)(source.x+source.w)/(float)textureWidth;
+		float v1 = (float)(source.y+source.h)/(float)textureHeight;
+		SDL_Color c = {color.r, color.g, color.b, alpha};
+		int first = vertices.size();
+		vertices.push_back({{rect.x, rect.y}, c, {u0, v0}});
+		vertices.push_back({{rect.x+rect.w, rect.y}, c, {u1, v0}});
+		vertices.push_back({{rect.x+rect.w, rect.y+rect.h}, c, {u1, v1}});
+		vertices.push_back({{rect.x, rect.y+rect.h}, c, {u0, v1}});
+		indices.push_back(first);
+		indices.push_back(first+1);
+		indices.push_back(first+2);
+		indices.push_back(first);
+		indices.push_back(first+2);
+		indices.push_back(first+3);
 	}
 
-	bool isInside(CoordInt pos, Camera* camera){
-		CoordInt screenPos = camera->toCameraCoordinates(position);
-		if(screenPos.x < pos.x - hitbox_size){return false;}
-		if(screenPos.y < pos.y - hitbox_size){return false;}
-		if(screenPos.x > pos.x + hitbox_size){return false;}
-		if(screenPos.y > pos.y + hitbox_size){return false;}
-		return true;
+	void add(SDL_Rect rect, SDL_Rect source, Color color, unsigned char alpha = 255){
+		add(SDL_FRect{(float)rect.x, (float)rect.y, (float)rect.w, (float)rect.h}, source, color, alpha);
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture, Camera* camera, cv::Mat* icon, SDL_Texture* textTexture, bool showTextBox){
-		SDL_UpdateTexture(texture, NULL, (*icon).data, (*icon).cols * (*icon).channels());
-		CoordInt renderPos = (*camera).toCameraCoordinates(position);
-		SDL_Rect rect = {renderPos.x - (ICON_RES/2), renderPos.y-(ICON_RES/2), ICON_RES, ICON_RES};
+	int flush(SDL_Renderer* renderer, SDL_Texture* texture){
+		int drawCalls = 0;
+		if(!indices.empty()){
+			SDL_RenderGeometry(renderer, texture, vertices.data(), vertices.size(), indices.data(), indices.size());
+			drawCalls++;
+		}
+		vertices.clear();
+		indices.clear();
+		return drawCalls;
+	}
+};
+
+struct Glyph{
+	SDL_Rect source;
+	float advance;
+
+	Glyph(): source(), advance() {}
+	Glyph(SDL_Rect source, float advance){
+		this->source = source;
+		this->advance = advance;
+	}
+};
+
+struct GlyphAtlas{
+	int font;
+	double scale;
+	int thickness;
+	int ascent;
+	int descent;
+
+	std::vector<Glyph> glyphs = {};
+	cv::Mat image;
+	SDL_Texture* texture = NULL;
+	QuadBatch batch;
+
+	GlyphAtlas(): font(), scale(), thickness(), ascent(), descent(), image() {}
+	GlyphAtlas(int font, double scale, int thickness){
+		this->font = font;
+		this->scale = scale;
+		this->thickness = thickness;
+		build();
+	}
+
+	void build(){
+		int baseline = 0;
+		ascent = cv::getTextSize("A", font, scale, thickness, &baseline).height;
+		descent = baseline;
+		int cellHeight = ascent + descent + 2*GLYPH_PADDING;
+
+		std::vector<cv::Size> sizes = {};
+		int x = 0;
+		int rows = 1;
+		for(int c = GLYPH_FIRST; c <= GLYPH_LAST; c++){
+			cv::Size size = cv::getTextSize(std::string(1, (char)c), font, scale, thickness, &baseline);
+			size.width += 2*GLYPH_PADDING;
+			if(x + size.width > GLYPH_ATLAS_WIDTH){
+				x = 0;
+				rows++;
+			}
+			x += size.width;
+			sizes.push_back(size);
+		}
+
+		image = cv::Mat(rows*cellHeight, GLYPH_ATLAS_WIDTH, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+		glyphs = {};
+		x = 0;
+		int y = 0;
+		for(int c = GLYPH_FIRST; c <= GLYPH_LAST; c++){
+			cv::Size size = sizes.at(c - GLYPH_FIRST);
+			if(x + size.width > GLYPH_ATLAS_WIDTH){
+				x = 0;
+				y += cellHeight;
+			}
+			cv::Mat cell = image(cv::Rect(x, y, size.width, cellHeight));
+			cv::putText(cell, std::string(1, (char)c), cv::Point(GLYPH_PADDING, GLYPH_PADDING + ascent), font, scale, cv::Scalar(255, 255, 255, 255), thickness, 8, false);
+			glyphs.push_back(Glyph(SDL_Rect{x, y, size.width, cellHeight}, (float)(size.width - 2*GLYPH_PADDING - thickness)));
+			x += size.width;
+		}
+	}
+
+	void upload(SDL_Renderer* renderer){
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, image.cols, image.rows);
+		SDL_UpdateTexture(texture, NULL, image.data, image.step);
 		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-		SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+		batch = QuadBatch(image.cols, image.rows);
+	}
+
+	Glyph* getGlyph(char c){
+		if((unsigned char)c < GLYPH_FIRST || (unsigned char)c > GLYPH_LAST){c = '?';}
+		return &glyphs.at((unsigned char)c - GLYPH_FIRST);
+	}
 
-		SDL_SetTextureBlendMode(textTexture, SDL_BLENDMODE_BLEND);
-		SDL_UpdateTexture(textTexture, NULL, textImage.data, textImage.cols*textImage.channels());
-		SDL_SetTextureColorMod(textTexture, labelColor.r, labelColor.g, labelColor.b);
-		SDL_Rect textRect = {rect.x - ((TEXT_WIDTH-ICON_RES)/2), rect.y-TEXT_HEIGHT, TEXT_WIDTH, TEXT_HEIGHT};
+	float getAdvance(char c){
+		return getGlyph(c)->advance;
+	}
 
-		SDL_RenderCopy(renderer, texture, NULL, &rect);
-		SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-		if(showTextBox){
-		SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-		SDL_RenderDrawRect(renderer, &textRect);
+	int measure(std::string* text){
+		float width = 0;
+		for(int i = 0; i < text->size(); i++){
+			width += getAdvance(text->at(i));
 		}
+		return std::round(width + thickness);
+	}
 
-		SDL_SetTextureColorMod(textTexture, 255, 255, 255);
-		SDL_SetTextureColorMod(texture, 255, 255, 255);
+	int getLineHeight(){
+		return ascent;
 	}
 
-	static Marker fromBuffer(std::vector<unsigned char>* data, int offset){
-		Marker marker = Marker();
-		marker.position.x = intFromBytes(data, offset);
-		marker.position.y = intFromBytes(data, offset + 4);
-		marker.levelLink = intFromBytes(data, offset + 8);
-		marker.iconId = intFromBytes(data, offset + 12);
-		marker.color = Color::fromBuffer(data, offset + 16);
-		marker.labelColor = Color::fromBuffer(data, offset + 19);
-		int labelSize = intFromBytes(data, offset + 22);
-		std::string label;
-		for(int i = offset + 26; i < offset + 26 + labelSize; i++){
-			label.push_back(data->at(i));
-		}
-		marker.UpdateLabel(label);
-		marker.hitbox_size = ICON_RES/2;
-		return marker;
+	void addText(std::string* text, float x, float baselineY, Color color){
+		float penX = x;
+		for(int i = 0; i < text->size(); i++){
+			Glyph* glyph = getGlyph(text->at(i));
+			if(text->at(i) != ' '){
+				SDL_FRect rect = {std::round(penX) - GLYPH_PADDING, baselineY - ascent - GLYPH_PADDING, (float)glyph->source.w, (float)glyph->source.h};
+				batch.add(rect, glyph->source, color);
+			}
+			penX += glyph->advance;
+		}
 	}
 
+	int flush(SDL_Renderer* renderer){
+		return batch.flush(renderer, texture);
+	}
 };
 
-struct GuiScrollComponent{
+struct GuiToggleComponent{
 	CoordInt position;
-	int maxScroll;
-	int scrollIndex;
 
-	GuiScrollComponent(): position(), maxScroll(), scrollIndex() {}
-	GuiScrollComponent(CoordInt position, int maxScroll){
-		this->position = position;
-		this->maxScroll = maxScroll;
-		scrollIndex = 0;
-	}
+	Color color;
+	Color hoveringColor;
+	Color selectedColor;
+	cv::Mat* image;
+	bool isToggled = false;
 
-	void scroll(int toScroll){
-		scrollIndex += toScroll;
-		scrollIndex = scrollIndex % maxScroll;
-		if(scrollIndex < 0){
-			scrollIndex = scrollIndex+maxScroll;
-		}
+	GuiToggleComponent(): position(), color(), hoveringColor(), selectedColor(), image() {}
+	GuiToggleComponent(CoordInt position, Color color, Color hoveringColor, Color selectedColor, cv::Mat* image){
+		this->position = position;
+		this->color = color;
+		this->hoveringColor = hoveringColor;
+		this->selectedColor = selectedColor;
+		this->image = image;
 	}
 
 	bool isInside(CoordInt pos){
@@ -542,106 +1453,1443 @@ struct GuiScrollComponent{
 		return true;
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture, cv::Mat* image, Color color = Color(255, 255, 255)){
-		SDL_UpdateTexture(texture, NULL, (*image).data,  (*image).cols * (*image).channels());
-		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	void render(SDL_Renderer* renderer, SDL_Texture* texture, bool isHovering){
+		SDL_UpdateTexture(texture, NULL, (*image).data,(*image).cols * (*image).channels());
 		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 		SDL_Rect rect = {position.x, position.y, ICON_RES, ICON_RES};
-		SDL_SetTextureColorMod(texture, color.r, color.g,color.b);
+		if(isHovering){
+			SDL_SetTextureColorMod(texture, hoveringColor.r, hoveringColor.g, hoveringColor.b);
+		}
+		else if(isToggled){
+			SDL_SetTextureColorMod(texture, selectedColor.r, selectedColor.g, selectedColor.b);
+		}
+		else{
+			SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+		}
 		SDL_RenderCopy(renderer, texture, NULL, &rect);
 		SDL_SetTextureColorMod(texture, 255, 255, 255);
 	}
+	void toggle(){
+		isToggled = !isToggled;
+	}
+
+};
+
+struct MenuOption{
+	Color textColor;
+	Color backgroundColor;
+
+	bool isEnabled = true;
+
+	std::string name;
+	int width;
+	int height;
+
+	int optionType;
+
+	MenuOption(): textColor(), backgroundColor(), name(), width(), height() {}
+	MenuOption(int width, int height, std::string name, Color textColor, Color backgroundColor, int optionType,bool isEnabled = true){
+		this->width = width;
+		this->height = height;
+		this->name = name;
+		this->textColor = textColor;
+		this->backgroundColor = backgroundColor;
+		this->isEnabled = isEnabled;
+		this->optionType = optionType;
+		updateName(name);
+	}
+
+	void updateName(std::string name){
+		this->name = name;
+	}
+
+	bool isInsde(CoordInt position, CoordInt pos, int Yoffset){
+		if(!isEnabled){return false;}
+		if(pos.x < position.x){return false;}
+		if(pos.y < position.y+Yoffset){return false;}
+		if(pos.x > position.x+width){return false;}
+		if(pos.y > position.y+Yoffset+height){return false;}
+		return true;
+	}
+
+	int render(SDL_Renderer* renderer, GlyphAtlas* font, CoordInt position, int Yoffset){
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+		SDL_Rect rect = {position.x, position.y+Yoffset, MENU_OPTIONWIDTH, MENU_OPTIONHEIGHT};
+		SDL_SetRenderDrawColor(renderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, 255);
+		SDL_RenderFillRect(renderer, &rect);
+		font->addText(&name, rect.x, rect.y + MENU_OPTIONHEIGHT-5, textColor);
+		return 1;
+	}
+
+};
+
+struct LeftCLickMenu{
+	CoordInt position;
+	std::vector<MenuOption> options;
+
+	LeftCLickMenu(): position() {}
+	LeftCLickMenu(CoordInt position){
+		this->position = position;
+	}
+
+	int getOption(CoordInt pos){
+
+		int Yoffset = 0;
+		for(int i = 0; i < options.size(); i++){
+			if(options.at(i).isInsde(position, pos, Yoffset)){
+				return i;
+			}
+			if(options.at(i).isEnabled){
+				Yoffset += options.at(i).height;
+			}
+		}
+		return -1;
+	}
+
+	int render(SDL_Renderer* renderer, GlyphAtlas* font){
+		int drawCalls = 0;
+		int Yoffset = 0;
+		for(int i = 0; i < options.size(); i++){
+			if(options.at(i).isEnabled){
+				drawCalls += options.at(i).render(renderer, font, position, Yoffset);
+				Yoffset += options.at(i).height;
+			}
+		}
+		drawCalls += font->flush(renderer);
+		return drawCalls;
+	}
+
+	void addOption(MenuOption option){
+		options.push_back(option);
+	}
+
+};
+
+struct Marker{
+	CoordInt position;
+	Color color;
+	Color labelColor;
+	std::string label;
+	int iconId;
+	int hitbox_size;
+
+	int levelLink = -1;
+
+	std::vector<std::string> labelLines = {};
+	std::vector<int> labelLineWidths = {};
+	std::vector<int> labelBreaks = {};
+	std::vector<float> labelAdvances = {};
+	std::string layoutLabel = "";
+	bool isLabelLayoutDirty = true;
+
+	Marker(): position(), color(), labelColor(), iconId(), label() {};
+	Marker(CoordInt position, Color color, Color labelColor, std::string label, int iconIndex, int hitbox_size){
+		this->position = position;
+		this->color = color;
+		this->labelColor = labelColor;
+		this->iconId = iconIndex;
+		this->hitbox_size = hitbox_size;
+
+		UpdateLabel(label);
+	}
+
+	void UpdateLabel(std::string label){
+		this->label = label;
+		isLabelLayoutDirty = true;
+	}
+
+	int getLabelWidth(GlyphAtlas* font, int start, int end){
+		return std::round(labelAdvances.at(end) - labelAdvances.at(start) + font->thickness);
+	}
+
+	void updateLabelLayout(GlyphAtlas* font){
+		if(!isLabelLayoutDirty){return;}
+
+		int edited = 0;
+		while(edited < label.size() && edited < layoutLabel.size() && label.at(edited) == layoutLabel.at(edited)){
+			edited++;
+		}
+
+		labelAdvances.resize(label.size()+1, 0.0f);
+		for(int i = edited; i < label.size(); i++){
+			labelAdvances.at(i+1) = labelAdvances.at(i) + font->getAdvance(label.at(i));
+		}
+
+		int keptLines = 0;
+		while(keptLines+1 < labelBreaks.size() && labelBreaks.at(keptLines+1) < edited){
+			keptLines++;
+		}
+		if(labelBreaks.empty()){labelBreaks.push_back(0);}
+		labelBreaks.resize(keptLines+1);
+		labelLines.resize(std::min((int)labelLines.size(), keptLines));
+		labelLineWidths.resize(labelLines.size());
+
+		int lineStart = labelBreaks.back();
+		for(int i = (keptLines == 0 ? 0 : lineStart+1); i < label.size(); i++){
+			if(getLabelWidth(font, lineStart, i+1) > TEXT_WIDTH || (i == 0 ? false : label.at(i-1) == '\n')){
+				labelBreaks.push_back(i);
+				lineStart = i;
+			}
+		}
+
+		for(int line = keptLines; line < labelBreaks.size(); line++){
+			int start = labelBreaks.at(line);
+			bool isLast = line == labelBreaks.size()-1;
+			int end = isLast ? label.size() : labelBreaks.at(line+1);
+			if(end > start && label.at(end-1) == '\n'){end--;}
+			if(isLast && start == label.size()){break;}
+			labelLines.push_back(label.substr(start, end-start));
+			labelLineWidths.push_back(getLabelWidth(font, start, end));
+			if(isLast && end != label.size()){
+				labelLines.push_back("");
+				labelLineWidths.push_back(getLabelWidth(font, 0, 0));
+			}
+		}
+
+		layoutLabel = label;
+		isLabelLayoutDirty = false;
+	}
+
+	SDL_Rect getLabelRect(Camera* camera){
+		SDL_Rect rect = getIconRect(camera);
+		return SDL_Rect{rect.x - ((TEXT_WIDTH-ICON_RES)/2), rect.y-TEXT_HEIGHT, TEXT_WIDTH, TEXT_HEIGHT};
+	}
+
+	void addLabel(GlyphAtlas* font, Camera* camera){
+		updateLabelLayout(font);
+		SDL_Rect textRect = getLabelRect(camera);
+		int lineCount = labelLines.size();
+		int lineHeight = font->getLineHeight();
+
+		for(int i = 0; i < lineCount; i++){
+			int width = labelLineWidths.at(i);
+			font->addText(
+				&labelLines.at(i),
+				textRect.x + (TEXT_WIDTH/2)-(width/2),
+				textRect.y + TEXT_HEIGHT - ((lineCount-i)*lineHeight + (lineCount-i-1)*LINE_SPACE),
+				labelColor
+			);
+		}
+	}
+
+	bool isVisible(Camera* camera){
+		CoordInt renderPos = camera->toCameraCoordinates(position);
+		if(renderPos.x + TEXT_WIDTH/2 < 0){return false;}
+		if(renderPos.x - TEXT_WIDTH/2 > camera->renderWidth){return false;}
+		if(renderPos.y + ICON_RES/2 < 0){return false;}
+		if(renderPos.y - ICON_RES/2 - TEXT_HEIGHT > camera->renderHeight){return false;}
+		return true;
+	}
+
+	void writeSaveData(BinaryWriter* writer){
+		position.writeSaveData(writer);
+		writer->putInt(levelLink);
+		writer->putInt(iconId);
+		color.writeSaveData(writer);
+		labelColor.writeSaveData(writer);
+		writer->putInt(label.size());
+		writer->putString(label);
+	}
+
+	bool isInside(CoordInt pos, Camera* camera){
+		CoordInt screenPos = camera->toCameraCoordinates(position);
+		if(screenPos.x < pos.x - hitbox_size){return false;}
+		if(screenPos.y < pos.y - hitbox_size){return false;}
+		if(screenPos.x > pos.x + hitbox_size){return false;}
+		if(screenPos.y > pos.y + hitbox_size){return false;}
+		return true;
+	}
+
+	SDL_Rect getIconRect(Camera* camera){
+		CoordInt renderPos = (*camera).toCameraCoordinates(position);
+		return SDL_Rect{renderPos.x - (ICON_RES/2), renderPos.y-(ICON_RES/2), ICON_RES, ICON_RES};
+	}
+
+	void addIcon(QuadBatch* batch, Camera* camera, SDL_Rect source){
+		batch->add(getIconRect(camera), source, color);
+	}
+
+	void renderTextBox(SDL_Renderer* renderer, Camera* camera){
+		SDL_Rect textRect = getLabelRect(camera);
+		SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+		SDL_RenderDrawRect(renderer, &textRect);
+	}
+
+	static Marker fromBuffer(BinaryReader* reader){
+		Marker marker = Marker();
+		marker.position.x = reader->getInt();
+		marker.position.y = reader->getInt();
+		marker.levelLink = reader->getInt();
+		marker.iconId = reader->getInt();
+		marker.color = Color::fromBuffer(reader);
+		marker.labelColor = Color::fromBuffer(reader);
+		int labelSize = reader->getInt();
+		marker.UpdateLabel(reader->getString(labelSize));
+		marker.hitbox_size = ICON_RES/2;
+		return marker;
+	}
+
+};
+
+struct GuiScrollComponent{
+	CoordInt position;
+	int maxScroll;
+	int scrollIndex;
+
+	GuiScrollComponent(): position(), maxScroll(), scrollIndex() {}
+	GuiScrollComponent(CoordInt position, int maxScroll){
+		this->position = position;
+		this->maxScroll = maxScroll;
+		scrollIndex = 0;
+	}
+
+	void scroll(int toScroll){
+		scrollIndex += toScroll;
+		scrollIndex = scrollIndex % maxScroll;
+		if(scrollIndex < 0){
+			scrollIndex = scrollIndex+maxScroll;
+		}
+	}
+
+	bool isInside(CoordInt pos){
+		if(pos.x < position.x){return false;}
+		if(pos.y < position.y){return false;}
+		if(pos.x > position.x+ICON_RES){return false;}
+		if(pos.y > position.y+ICON_RES){return false;}
+		return true;
+	}
+
+	void render(QuadBatch* batch, SDL_Rect source, Color color = Color(255, 255, 255)){
+		SDL_Rect rect = {position.x, position.y, ICON_RES, ICON_RES};
+		batch->add(rect, source, color);
+	}
+
+};
+
+struct GuiColorScrollComponent{
+	CoordInt position;
+	int maxScroll;
+	int scrollIndex;
+
+	GuiColorScrollComponent(): position(), maxScroll(), scrollIndex() {}
+	GuiColorScrollComponent(CoordInt position, int maxScroll){
+		this->position = position;
+		this->maxScroll = maxScroll;
+		scrollIndex = 0;
+	}
+
+	void scroll(int toScroll){
+		scrollIndex += toScroll;
+		if(scrollIndex >= maxScroll){scrollIndex = maxScroll-1;}
+		if(scrollIndex < 0){scrollIndex = 0;}
+	}
+
+	bool isInside(CoordInt pos){
+		if(pos.x < position.x){return false;}
+		if(pos.y < position.y){return false;}
+		if(pos.x > position.x+ICON_RES){return false;}
+		if(pos.y > position.y+ICON_RES){return false;}
+		return true;
+	}
+
+	void render(QuadBatch* batch, SDL_Rect source, Color color = Color(255, 255, 255)){
+		SDL_Rect rect = {position.x, position.y, ICON_RES, ICON_RES};
+		batch->add(rect, source, color);
+	}
+
+};
+
+struct MarkerGrid{
+	std::unordered_map<int64_t, std::vector<int>> cells;
+
+	MarkerGrid(): cells() {}
+
+	static int getCell(int x){
+		return (int)std::floor((float)x/(float)MARKER_GRID_CELL_SIZE);
+	}
+
+	static int64_t getKey(int cellX, int cellY){
+		return (int64_t)(((uint64_t)(uint32_t)cellX << 32) | (uint32_t)cellY);
+	}
+
+	void build(std::vector<Marker>* markers){
+		cells.clear();
+		for(int i = 0; i < markers->size(); i++){
+			insert(i, markers->at(i).position);
+		}
+	}
+
+	void insert(int index, CoordInt position){
+		cells[getKey(getCell(position.x), getCell(position.y))].push_back(index);
+	}
+
+	void remove(int index, CoordInt position){
+		std::unordered_map<int64_t, std::vector<int>>::iterator it = cells.find(getKey(getCell(position.x), getCell(position.y)));
+		if(it == cells.end()){return;}
+		std::vector<int>::iterator entry = std::find(it->second.begin(), it->second.end(), index);
+		if(entry != it->second.end()){it->second.erase(entry);}
+		if(it->second.empty()){cells.erase(it);}
+	}
+
+	void move(int index, CoordInt from, CoordInt to){
+		if(getCell(from.x) == getCell(to.x) && getCell(from.y) == getCell(to.y)){return;}
+		remove(index, from);
+		insert(index, to);
+	}
+
+	void reindex(int from, int to, CoordInt position){
+		std::unordered_map<int64_t, std::vector<int>>::iterator it = cells.find(getKey(getCell(position.x), getCell(position.y)));
+		if(it == cells.end()){return;}
+		std::vector<int>::iterator entry = std::find(it->second.begin(), it->second.end(), from);
+		if(entry != it->second.end()){*entry = to;}
+	}
+
+	std::vector<int> query(int left, int top, int right, int bottom){
+		std::vector<int> result = {};
+		int firstX = getCell(left);
+		int firstY = getCell(top);
+		int lastX = getCell(right);
+		int lastY = getCell(bottom);
+
+		if((int64_t)(lastX-firstX+1)*(int64_t)(lastY-firstY+1) > (int64_t)cells.size()){
+			for(std::unordered_map<int64_t, std::vector<int>>::iterator it = cells.begin(); it != cells.end(); it++){
+				int cellX = (int)(it->first >> 32);
+				int cellY = (int)(int32_t)(it->first & 0xffffffff);
+				if(cellX < firstX || cellX > lastX || cellY < firstY || cellY > lastY){continue;}
+				result.insert(result.end(), it->second.begin(), it->second.end());
+			}
+		}
+		else{
+			for(int cellY = firstY; cellY <= lastY; cellY++){
+				for(int cellX = firstX; cellX <= lastX; cellX++){
+					std::unordered_map<int64_t, std::vector<int>>::iterator it = cells.find(getKey(cellX, cellY));
+					if(it != cells.end()){
+						result.insert(result.end(), it->second.begin(), it->second.end());
+					}
+				}
+			}
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+};
+
+struct FileSection{
+	int64_t offset;
+	int64_t size;
+	uint32_t checksum;
+
+	FileSection(): offset(), size(), checksum() {}
+	FileSection(int64_t offset, int64_t size, uint32_t checksum){
+		this->offset = offset;
+		this->size = size;
+		this->checksum = checksum;
+	}
+
+	void writeSaveData(BinaryWriter* writer){
+		writer->putInt64(offset);
+		writer->putInt64(size);
+		writer->putInt(checksum);
+	}
+
+	static FileSection fromBuffer(BinaryReader* reader){
+		int64_t offset = reader->getInt64();
+		int64_t size = reader->getInt64();
+		uint32_t checksum = reader->getInt();
+		return FileSection(offset, size, checksum);
+	}
+
+	static std::vector<unsigned char> read(std::ifstream* file, int64_t offset, int64_t size){
+		if(offset < 0 || size < 0){return {};}
+		std::vector<unsigned char> data(size);
+		file->seekg(offset);
+		file->read(reinterpret_cast<char*>(data.data()), size);
+		if(file->gcount() != size){
+			data.clear();
+			file->clear();
+		}
+		return data;
+	}
+
+	bool view(ByteView* file, ByteView* data){
+		if(!file->contains(offset, size)){return false;}
+		*data = file->slice(offset, size);
+		return crc32(data->data, data->size) == checksum;
+	}
+};
+
+// A campaign file that stays mapped while levels borrow their encoded images
+// from it. SaveWorker locks it exclusively to close it around the rename that
+// replaces the file, then reopens it on the saved file.
+struct SharedMapping{
+	std::string path;
+	MappedFile file;
+	std::shared_mutex mutex;
+
+	SharedMapping() {}
+
+	static std::shared_ptr<SharedMapping> open(std::string path){
+		std::shared_ptr<SharedMapping> mapping = std::make_shared<SharedMapping>();
+		mapping->path = path;
+		if(!mapping->file.open(path)){return NULL;}
+		return mapping;
+	}
+};
+
+// Encoded bytes of a level image: either an owned buffer (imported files and
+// evicted levels) or a range of a SharedMapping, which is never copied.
+struct EncodedImage{
+	std::vector<unsigned char> bytes = {};
+	std::shared_ptr<SharedMapping> mapping;
+	int64_t offset = 0;
+	int64_t size = 0;
+
+	EncodedImage() {}
+	EncodedImage(std::vector<unsigned char> bytes){
+		this->bytes = std::move(bytes);
+		this->size = this->bytes.size();
+	}
+	EncodedImage(std::shared_ptr<SharedMapping> mapping, int64_t offset, int64_t size){
+		this->mapping = mapping;
+		this->offset = offset;
+		this->size = size;
+	}
+
+	bool isMapped(){
+		return mapping != NULL;
+	}
+
+	cv::Mat decode(int flags){
+		if(!isMapped()){return cv::imdecode(bytes, flags);}
+		std::shared_lock<std::shared_mutex> lock(mapping->mutex);
+		ByteView file = ByteView(mapping->file.data, mapping->file.size);
+		if(!file.contains(offset, size)){return cv::Mat();}
+		return cv::imdecode(file.slice(offset, size).asMat(), flags);
+	}
+
+	bool writeSaveData(BinaryWriter* writer){
+		if(!isMapped()){
+			writer->putBytes(bytes.data(), bytes.size());
+			return true;
+		}
+		std::shared_lock<std::shared_mutex> lock(mapping->mutex);
+		ByteView file = ByteView(mapping->file.data, mapping->file.size);
+		if(!file.contains(offset, size)){return false;}
+		writer->putBytes(file.data + offset, size);
+		return true;
+	}
+};
+
+struct Level {
+	int parentId;
+	cv::Mat backgroundImage;
+	std::vector<cv::Mat> pyramid = {};
+	std::shared_ptr<VirtualImage> virtualImage;
+	std::shared_ptr<EncodedImage> encodedImage;
+	int width = 0;
+	int height = 0;
+	cv::Mat thumbnail;
+	std::shared_ptr<std::vector<unsigned char>> encodedThumbnail;
+	std::vector<Marker> markers = {};
+	MarkerGrid markerGrid;
+
+	Level(): backgroundImage(){}
+	Level(cv::Mat backgroundimage, int parentId){
+		this->backgroundImage = backgroundimage;
+		this->parentId = parentId;
+		buildPyramid();
+	}
+
+	static Level fromImage(cv::Mat image, int parentId, std::shared_ptr<EncodedImage> encodedImage = NULL){
+		std::shared_ptr<VirtualImage> store = NULL;
+		if((int64_t)image.cols*(int64_t)image.rows >= VIRTUAL_IMAGE_MIN_PIXELS){store = VirtualImage::build(image, VirtualImage::getTemporaryPath());}
+		if(store == NULL){
+			Level level = Level(image, parentId);
+			level.encodedImage = encodedImage;
+			return level;
+		}
+		Level level = Level();
+		level.parentId = parentId;
+		level.virtualImage = store;
+		return level;
+	}
+
+	bool isVirtual(){
+		return virtualImage != NULL;
+	}
+
+	int getWidth(){
+		if(isVirtual()){return virtualImage->getWidth();}
+		return width;
+	}
+
+	int getHeight(){
+		if(isVirtual()){return virtualImage->getHeight();}
+		return height;
+	}
+
+	bool isResident(){
+		return isVirtual() || !backgroundImage.empty();
+	}
+
+	size_t getResidentBytes(){
+		size_t bytes = 0;
+		for(int i = 0; i < pyramid.size(); i++){
+			bytes += pyramid.at(i).total()*pyramid.at(i).elemSize();
+		}
+		return bytes;
+	}
+
+	void ensureResident(){
+		if(isResident() || encodedImage == NULL){return;}
+		backgroundImage = encodedImage->decode(LEVEL_IMAGE_READ_FLAGS);
+		buildPyramid();
+	}
+
+	void installPyramid(std::vector<cv::Mat> pyramid){
+		if(pyramid.empty() || pyramid.at(0).empty()){return;}
+		this->pyramid = pyramid;
+		backgroundImage = pyramid.at(0);
+		width = backgroundImage.cols;
+		height = backgroundImage.rows;
+		thumbnail = pyramid.back();
+	}
+
+	void evict(){
+		if(isVirtual() || backgroundImage.empty()){return;}
+		if(encodedImage == NULL){
+			std::vector<unsigned char> bytes = {};
+			cv::imencode(".png", backgroundImage, bytes, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, LEVEL_EVICT_PNG_COMPRESSION});
+			encodedImage = std::make_shared<EncodedImage>(bytes);
+		}
+		backgroundImage = cv::Mat();
+		pyramid = {};
+	}
+
+	std::vector<cv::Size> getPyramidSizes(){
+		if(isVirtual()){return virtualImage->getLevelSizes();}
+		std::vector<cv::Size> sizes = {};
+		for(int i = 0; i < pyramid.size(); i++){
+			sizes.push_back(pyramid.at(i).size());
+		}
+		return sizes;
+	}
+
+	cv::Mat getBackgroundSource(BackgroundView* view){
+		if(isVirtual()){return virtualImage->getViewRegion(view);}
+		return pyramid.at(view->pyramidLevel);
+	}
+
+	void buildPyramid(){
+		width = backgroundImage.cols;
+		height = backgroundImage.rows;
+		pyramid = makePyramid(backgroundImage);
+		thumbnail = pyramid.back();
+	}
+
+	static std::vector<cv::Mat> makePyramid(cv::Mat image){
+		std::vector<cv::Mat> pyramid = {image};
+		while(std::min(pyramid.back().cols, pyramid.back().rows)/2 >= PYRAMID_MIN_RES){
+			cv::Mat half;
+			cv::pyrDown(pyramid.back(), half);
+			pyramid.push_back(half);
+		}
+		return pyramid;
+	}
+
+	void addMarker(Marker marker){
+		markers.push_back(marker);
+		markerGrid.insert(markers.size()-1, marker.position);
+	}
+
+	// The last marker takes over the removed slot, so only its grid entry changes.
+	// Callers removing several markers must go from the highest index down.
+	void removeMarker(int index){
+		int last = markers.size()-1;
+		markerGrid.remove(index, markers.at(index).position);
+		if(index != last){
+			markerGrid.reindex(last, index, markers.at(last).position);
+			markers.at(index) = std::move(markers.at(last));
+		}
+		markers.pop_back();
+	}
+
+	void moveMarker(int index, CoordInt position){
+		markerGrid.move(index, markers.at(index).position, position);
+		markers.at(index).position = position;
+	}
+
+	std::vector<int> getMarkersInRect(int left, int top, int right, int bottom){
+		return markerGrid.query(left, top, right, bottom);
+	}
+
+	std::vector<int> getMarkersAt(CoordInt pos, Camera* camera){
+		CoordInt worldPos = camera->fromCameraCoordinates(pos);
+		std::vector<int> hits = {};
+		CoordInt extent = camera->scaleFromCameraCoordinates(CoordInt(ICON_RES/2 + 1, ICON_RES/2 + 1)).add(CoordInt(1, 1));
+		std::vector<int> candidates = markerGrid.query(worldPos.x - extent.x, worldPos.y - extent.y, worldPos.x + extent.x, worldPos.y + extent.y);
+		for(int i = 0; i < candidates.size(); i++){
+			if(markers.at(candidates.at(i)).isInside(pos, camera)){
+				hits.push_back(candidates.at(i));
+			}
+		}
+		return hits;
+	}
+
+	int getTopmostMarkerAt(CoordInt pos, Camera* camera){
+		std::vector<int> hits = getMarkersAt(pos, camera);
+		if(hits.empty()){return -1;}
+		return hits.back();
+	}
+
+	Level getSnapshot(){
+		if(encodedThumbnail == NULL && !thumbnail.empty()){
+			encodedThumbnail = std::make_shared<std::vector<unsigned char>>();
+			cv::imencode(".png", thumbnail, *encodedThumbnail);
+		}
+		Level level = Level();
+		level.parentId = parentId;
+		level.backgroundImage = backgroundImage;
+		level.virtualImage = virtualImage;
+		level.encodedImage = encodedImage;
+		level.width = width;
+		level.height = height;
+		level.encodedThumbnail = encodedThumbnail;
+		level.markers = markers;
+		return level;
+	}
+
+	void writeMetadata(BinaryWriter* writer){
+		if(encodedThumbnail == NULL && !thumbnail.empty()){
+			encodedThumbnail = std::make_shared<std::vector<unsigned char>>();
+			cv::imencode(".png", thumbnail, *encodedThumbnail);
+		}
+		writer->putInt(parentId);
+		writer->putInt(getWidth());
+		writer->putInt(getHeight());
+		writer->putInt(isVirtual() ? IMAGE_KIND_VIRTUAL : IMAGE_KIND_ENCODED);
+		writer->putInt(markers.size());
+		if(encodedThumbnail == NULL){
+			writer->putInt(0);
+			return;
+		}
+		writer->putInt(encodedThumbnail->size());
+		writer->putBytes(encodedThumbnail->data(), encodedThumbnail->size());
+	}
+
+	void writeMarkers(BinaryWriter* writer){
+		for(int i = 0; i < markers.size(); i++){
+			markers.at(i).writeSaveData(writer);
+		}
+	}
+
+	bool writeImage(BinaryWriter* writer){
+		if(isVirtual()){return virtualImage->writeSaveData(writer);}
+		if(encodedImage != NULL){return encodedImage->writeSaveData(writer);}
+		std::vector<unsigned char> imageData = {};
+		if(!cv::imencode(".png", backgroundImage, imageData, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, 9})){return false;}
+		writer->putBytes(imageData.data(), imageData.size());
+		return true;
+	}
+
+	// Returns false if the marker count does not fit the data or a record is truncated.
+	bool readMarkers(BinaryReader* reader, int markerCount){
+		if(markerCount < 0 || !reader->hasBytes((int64_t)markerCount*MARKER_HEADER_SIZE)){return false;}
+		markers.reserve(markers.size() + markerCount);
+		for(int i = 0; i < markerCount && !reader->isOverrun(); i++){
+			markers.push_back(Marker::fromBuffer(reader));
+		}
+		markerGrid.build(&markers);
+		return !reader->isOverrun();
+	}
+
+	static bool fromChunk(std::shared_ptr<SharedMapping> mapping, std::vector<FileSection> sections, bool decode, Level* level){
+		ByteView file = ByteView(mapping->file.data, mapping->file.size);
+		ByteView metadataView;
+		if(!sections.at(SECTION_METADATA).view(&file, &metadataView) || metadataView.size < LEVEL_METADATA_SIZE){return false;}
+		BinaryReader metadata = BinaryReader(metadataView);
+		level->parentId = metadata.getInt();
+		level->width = metadata.getInt();
+		level->height = metadata.getInt();
+		int imageKind = metadata.getInt();
+		int markerCount = metadata.getInt();
+		int thumbnailSize = metadata.getInt();
+		if(thumbnailSize > 0 && metadata.hasBytes(thumbnailSize)){
+			ByteView thumbnail = metadata.getBytes(thumbnailSize);
+			level->encodedThumbnail = std::make_shared<std::vector<unsigned char>>(thumbnail.toVector());
+			level->thumbnail = cv::imdecode(thumbnail.asMat(), cv::IMREAD_UNCHANGED);
+		}
+
+		ByteView markerData;
+		if(!sections.at(SECTION_MARKERS).view(&file, &markerData)){return false;}
+		BinaryReader markerReader = BinaryReader(markerData);
+		if(!level->readMarkers(&markerReader, markerCount)){return false;}
+
+		if(imageKind == IMAGE_KIND_VIRTUAL){
+			level->virtualImage = VirtualImage::open(mapping->path, sections.at(SECTION_IMAGE).offset, sections.at(SECTION_IMAGE).size);
+			return level->virtualImage != NULL;
+		}
+		ByteView image;
+		if(!sections.at(SECTION_IMAGE).view(&file, &image)){return false;}
+		level->encodedImage = std::make_shared<EncodedImage>(mapping, sections.at(SECTION_IMAGE).offset, sections.at(SECTION_IMAGE).size);
+		if(decode){level->ensureResident();}
+		return true;
+	}
+
+	// Parses a v1 level record in place and leaves reader at the next record. The
+	// encoded image stays in the mapping until the level is first decoded.
+	static bool fromBuffer(BinaryReader* reader, std::shared_ptr<SharedMapping> mapping, Level* level){
+		level->parentId = reader->getInt();
+		int markerCount = reader->getInt();
+		int imageSize = reader->getInt();
+
+		int64_t imageOffset = reader->cursor;
+		ByteView bytes = reader->getBytes(imageSize);
+		if(reader->isOverrun()){return false;}
+		if(VirtualImage::isStore(&bytes, 0, imageSize)){
+			level->virtualImage = VirtualImage::open(mapping->path, imageOffset, imageSize);
+			if(level->virtualImage == NULL){return false;}
+		}
+		else{
+			level->encodedImage = std::make_shared<EncodedImage>(mapping, imageOffset, imageSize);
+		}
+
+		return level->readMarkers(reader, markerCount);
+	}
+
+};
+
+struct LevelResidency{
+	size_t budgetBytes;
+	std::list<int> recent = {};
+
+	LevelResidency(): budgetBytes(LEVEL_RESIDENCY_BUDGET) {}
+	LevelResidency(size_t budgetBytes){
+		this->budgetBytes = budgetBytes;
+	}
+
+	void touch(int level){
+		recent.remove(level);
+		recent.push_front(level);
+	}
+
+	size_t getResidentBytes(std::vector<Level>* levels){
+		size_t bytes = 0;
+		for(int i = 0; i < levels->size(); i++){
+			bytes += levels->at(i).getResidentBytes();
+		}
+		return bytes;
+	}
+
+	int enforce(std::vector<Level>* levels, int currentLevel){
+		int evicted = 0;
+		int parentLevel = levels->at(currentLevel).parentId;
+		size_t used = getResidentBytes(levels);
+		for(int i = 0; i < levels->size() && used > budgetBytes; i++){
+			if(i == currentLevel || i == parentLevel || std::find(recent.begin(), recent.end(), i) != recent.end()){continue;}
+			used -= levels->at(i).getResidentBytes();
+			levels->at(i).evict();
+			evicted++;
+		}
+		for(std::list<int>::reverse_iterator it = recent.rbegin(); it != recent.rend() && used > budgetBytes; it++){
+			if(*it == currentLevel || *it == parentLevel || *it >= levels->size()){continue;}
+			used -= levels->at(*it).getResidentBytes();
+			levels->at(*it).evict();
+			evicted++;
+		}
+		return evicted;
+	}
+};
+
+struct PrefetchedLevel{
+	int level;
+	std::shared_ptr<EncodedImage> source;
+	std::vector<cv::Mat> pyramid;
+
+	PrefetchedLevel(): level(-1), source(), pyramid() {}
+	PrefetchedLevel(int level, std::shared_ptr<EncodedImage> source){
+		this->level = level;
+		this->source = source;
+	}
+};
+
+struct LevelPrefetcher{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool isRunning = false;
+	Uint32 doneEventType = 0;
+
+	std::deque<PrefetchedLevel> pending = {};
+	std::vector<int> inFlight = {};
+	std::vector<PrefetchedLevel> finished = {};
+
+	LevelPrefetcher() {}
+	~LevelPrefetcher(){
+		stop();
+	}
+
+	void start(Uint32 doneEventType){
+		this->doneEventType = doneEventType;
+		isRunning = true;
+		thread = std::thread(&LevelPrefetcher::run, this);
+	}
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isRunning = false;
+		}
+		condition.notify_all();
+		if(thread.joinable()){thread.join();}
+	}
+
+	bool isQueued(int level){
+		return std::find(inFlight.begin(), inFlight.end(), level) != inFlight.end();
+	}
+
+	bool request(int level, std::shared_ptr<EncodedImage> source){
+		if(source == NULL){return false;}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!isRunning){return false;}
+			if(isQueued(level)){
+				// Not started yet: move it ahead of older requests such as hover prefetches.
+				for(int i = 0; i < pending.size(); i++){
+					if(pending.at(i).level != level){continue;}
+					PrefetchedLevel job = pending.at(i);
+					pending.erase(pending.begin() + i);
+					pending.push_front(job);
+					break;
+				}
+				return false;
+			}
+			pending.push_front(PrefetchedLevel(level, source));
+			inFlight.push_back(level);
+		}
+		condition.notify_one();
+		return true;
+	}
+
+	void run(){
+		while(true){
+			PrefetchedLevel job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]{return !pending.empty() || !isRunning;});
+				if(!isRunning){return;}
+				job = pending.front();
+				pending.pop_front();
+			}
+
+			job.pyramid = Level::makePyramid(job.source->decode(LEVEL_IMAGE_READ_FLAGS));
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.push_back(job);
+			}
+
+			SDL_Event event;
+			SDL_zero(event);
+			event.type = doneEventType;
+			SDL_PushEvent(&event);
+		}
+	}
+
+	std::vector<PrefetchedLevel> takeFinished(){
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<PrefetchedLevel> done = finished;
+		finished = {};
+		for(int i = 0; i < done.size(); i++){
+			inFlight.erase(std::remove(inFlight.begin(), inFlight.end(), done.at(i).level), inFlight.end());
+		}
+		return done;
+	}
+};
+
+struct SaveWorker{
+	std::thread thread;
+	std::mutex mutex;
+	bool isSaving = false;
+	bool hasResult = false;
+	bool isSuccess = false;
+	std::string resultPath = "";
+	Uint32 doneEventType = 0;
+
+	SaveWorker() {}
+	~SaveWorker(){
+		stop();
+	}
+
+	void setEventType(Uint32 doneEventType){
+		this->doneEventType = doneEventType;
+	}
+
+	void stop(){
+		if(thread.joinable()){thread.join();}
+	}
+
+	bool isBusy(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return isSaving;
+	}
+
+	bool start(std::vector<Level> snapshot, std::string path){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(isSaving){return false;}
+			isSaving = true;
+		}
+		if(thread.joinable()){thread.join();}
+		thread = std::thread(&SaveWorker::run, this, snapshot, path);
+		return true;
+	}
+
+	bool takeResult(bool* success, std::string* path){
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!hasResult){return false;}
+		hasResult = false;
+		*success = isSuccess;
+		*path = resultPath;
+		return true;
+	}
+
+	// Streams the v2 container into file one section at a time. The section table
+	// is reserved first and rewritten at the end, once every section's offset,
+	// size and checksum is known.
+	static bool writeSaveData(std::ostream* file, std::vector<Level>* levels, std::vector<int64_t>* imageOffsets = NULL){
+		BinaryWriter writer = BinaryWriter(file);
+		writer.putInt(FILE_FORMAT_VERSION);
+		writer.putInt(levels->size());
+		int64_t tableStart = writer.offset;
+		std::vector<FileSection> table(levels->size()*LEVEL_SECTION_COUNT);
+		for(int i = 0; i < table.size(); i++){
+			table.at(i).writeSaveData(&writer);
+		}
+
+		for(int i = 0; i < levels->size(); i++){
+			Level* level = &levels->at(i);
+			for(int j = 0; j < LEVEL_SECTION_COUNT; j++){
+				FileSection* section = &table.at(i*LEVEL_SECTION_COUNT + j);
+				section->offset = writer.offset;
+				writer.resetChecksum();
+				if(j == SECTION_METADATA){level->writeMetadata(&writer);}
+				if(j == SECTION_MARKERS){level->writeMarkers(&writer);}
+				if(j == SECTION_IMAGE){
+					if(!level->writeImage(&writer)){return false;}
+					if(imageOffsets != NULL){imageOffsets->push_back(section->offset);}
+				}
+				section->size = writer.offset - section->offset;
+				section->checksum = writer.checksum;
+			}
+		}
+
+		writer.seek(tableStart);
+		for(int i = 0; i < table.size(); i++){
+			table.at(i).writeSaveData(&writer);
+		}
+		return writer.flush();
+	}
+
+	static bool writeAtomically(std::vector<Level>* levels, std::vector<int64_t>* imageOffsets, std::string path){
+		std::string tempPath = path + SAVE_TEMP_SUFFIX;
+		std::ofstream file(tempPath, std::ios::binary);
+		if(!file){return false;}
+		bool isWritten = writeSaveData(&file, levels, imageOffsets);
+		file.flush();
+		file.close();
+		if(!isWritten || file.fail()){
+			std::error_code error;
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+
+		// Windows cannot replace a file that is open or mapped, so every store and
+		// mapping that may point at the target is closed around the rename.
+		std::vector<VirtualImage*> stores = {};
+		std::vector<SharedMapping*> mappings = {};
+		for(int i = 0; i < levels->size(); i++){
+			if(levels->at(i).isVirtual()){stores.push_back(levels->at(i).virtualImage.get());}
+			std::shared_ptr<EncodedImage> image = levels->at(i).encodedImage;
+			if(image == NULL || !image->isMapped()){continue;}
+			if(std::find(mappings.begin(), mappings.end(), image->mapping.get()) == mappings.end()){mappings.push_back(image->mapping.get());}
+		}
+		for(int i = 0; i < stores.size(); i++){
+			stores.at(i)->mutex.lock();
+			stores.at(i)->file.close();
+		}
+		for(int i = 0; i < mappings.size(); i++){
+			mappings.at(i)->mutex.lock();
+			mappings.at(i)->file.close();
+		}
+
+		std::error_code error;
+		std::filesystem::rename(tempPath, path, error);
+
+		for(int i = 0; i < levels->size() && !error; i++){
+			std::shared_ptr<EncodedImage> image = levels->at(i).encodedImage;
+			if(image != NULL && image->isMapped()){image->offset = imageOffsets->at(i);}
+		}
+		for(int i = 0; i < mappings.size(); i++){
+			if(!error){mappings.at(i)->path = path;}
+			if(!mappings.at(i)->file.open(mappings.at(i)->path)){LOG("could not remap " << mappings.at(i)->path);}
+			mappings.at(i)->mutex.unlock();
+		}
+
+		int store = 0;
+		for(int i = 0; i < levels->size(); i++){
+			if(!levels->at(i).isVirtual()){continue;}
+			if(error){stores.at(store)->readIndex();}
+			else{stores.at(store)->relocateLocked(path, imageOffsets->at(i));}
+			stores.at(store)->mutex.unlock();
+			store++;
+		}
+
+		if(error){
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+		return true;
+	}
+
+	void run(std::vector<Level> snapshot, std::string path){
+		std::vector<int64_t> imageOffsets = {};
+		bool success = writeAtomically(&snapshot, &imageOffsets, path);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isSaving = false;
+			hasResult = true;
+			isSuccess = success;
+			resultPath = path;
+		}
+
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = doneEventType;
+		SDL_PushEvent(&event);
+	}
+};
+
+struct JournalRecord{
+	int op;
+	int level;
+	int index;
+	int a;
+	int b;
+	int c;
+	std::vector<unsigned char> payload;
+
+	JournalRecord(): op(), level(), index(), a(), b(), c(), payload(JOURNAL_PAYLOAD_SIZE, 0) {}
+	JournalRecord(int op, int level, int index, int a = 0, int b = 0, int c = 0){
+		this->op = op;
+		this->level = level;
+		this->index = index;
+		this->a = a;
+		this->b = b;
+		this->c = c;
+		payload = std::vector<unsigned char>(JOURNAL_PAYLOAD_SIZE, 0);
+	}
+
+	void writeSaveData(BinaryWriter* writer){
+		writer->resetChecksum();
+		writer->putInt(op);
+		writer->putInt(level);
+		writer->putInt(index);
+		writer->putInt(a);
+		writer->putInt(b);
+		writer->putInt(c);
+		writer->putBytes(payload.data(), payload.size());
+		writer->putInt(writer->checksum);
+	}
 
+	static bool fromBuffer(std::vector<unsigned char>* data, int offset, JournalRecord* record){
+		if(offset + JOURNAL_RECORD_SIZE > data->size()){return false;}
+		if(crc32(data->data() + offset, JOURNAL_RECORD_SIZE - 4) != (uint32_t)intFromBytes(data, offset + JOURNAL_RECORD_SIZE - 4)){return false;}
+		record->op = intFromBytes(data, offset);
+		record->level = intFromBytes(data, offset + 4);
+		record->index = intFromBytes(data, offset + 8);
+		record->a = intFromBytes(data, offset + 12);
+		record->b = intFromBytes(data, offset + 16);
+		record->c = intFromBytes(data, offset + 20);
+		record->payload = std::vector<unsigned char>(data->begin() + offset + 24, data->begin() + offset + 24 + JOURNAL_PAYLOAD_SIZE);
+		return true;
+	}
 };
 
-struct GuiColorScrollComponent{
-	CoordInt position;
-	int maxScroll;
-	int scrollIndex;
+struct EditJournal{
+	std::string path = "";
+	std::ofstream file;
+	std::vector<JournalRecord> records = {};
+	BinaryWriter recordWriter = BinaryWriter(NULL);
 
-	GuiColorScrollComponent(): position(), maxScroll(), scrollIndex() {}
-	GuiColorScrollComponent(CoordInt position, int maxScroll){
-		this->position = position;
-		this->maxScroll = maxScroll;
-		scrollIndex = 0;
+	EditJournal() {}
+
+	bool isOpen(){
+		return file.is_open();
 	}
 
-	void scroll(int toScroll){
-		scrollIndex += toScroll;
-		if(scrollIndex >= maxScroll){scrollIndex = maxScroll-1;}
-		if(scrollIndex < 0){scrollIndex = 0;}
+	static std::string getPath(std::string basePath){
+		return basePath + JOURNAL_SUFFIX;
 	}
 
-	bool isInside(CoordInt pos){
-		if(pos.x < position.x){return false;}
-		if(pos.y < position.y){return false;}
-		if(pos.x > position.x+ICON_RES){return false;}
-		if(pos.y > position.y+ICON_RES){return false;}
-		return true;
+	// Identifies the base file a journal belongs to: its size and a crc of its first bytes.
+	static void getFingerprint(std::string basePath, int64_t* size, uint32_t* checksum){
+		std::error_code error;
+		*size = std::filesystem::file_size(basePath, error);
+		if(error){*size = -1;}
+		std::ifstream base(basePath, std::ios::binary);
+		std::vector<unsigned char> prefix = FileSection::read(&base, 0, std::min((int64_t)JOURNAL_FINGERPRINT_BYTES, std::max((int64_t)0, *size)));
+		*checksum = crc32(prefix.data(), prefix.size());
 	}
 
-	void render(SDL_Renderer* renderer, SDL_Texture* texture, cv::Mat* image, Color color = Color(255, 255, 255)){
-		SDL_UpdateTexture(texture, NULL, (*image).data,  (*image).cols * (*image).channels());
-		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-		SDL_Rect rect = {position.x, position.y, ICON_RES, ICON_RES};
-		SDL_SetTextureColorMod(texture, color.r, color.g,color.b);
-		SDL_RenderCopy(renderer, texture, NULL, &rect);
-		SDL_SetTextureColorMod(texture, 255, 255, 255);
+	static void writeHeader(BinaryWriter* writer, std::string basePath){
+		int64_t size;
+		uint32_t checksum;
+		getFingerprint(basePath, &size, &checksum);
+		writer->putString(JOURNAL_MAGIC);
+		writer->putInt64(size);
+		writer->putInt(checksum);
+	}
+
+	static bool isHeaderFor(std::vector<unsigned char>* header, std::string basePath){
+		int64_t size;
+		uint32_t checksum;
+		getFingerprint(basePath, &size, &checksum);
+		BinaryReader reader = BinaryReader(ByteView(header));
+		bool isMatch = reader.getString(8) == JOURNAL_MAGIC && reader.getInt64() == size && (uint32_t)reader.getInt() == checksum;
+		return isMatch && !reader.isOverrun();
+	}
+
+	static std::vector<JournalRecord> read(std::string basePath){
+		std::vector<JournalRecord> records = {};
+		std::ifstream journal(getPath(basePath), std::ios::binary);
+		if(!journal.is_open()){return records;}
+		std::vector<unsigned char> header = FileSection::read(&journal, 0, JOURNAL_HEADER_SIZE);
+		if(!isHeaderFor(&header, basePath)){
+			LOG("journal does not match " << basePath << ", ignoring it");
+			return records;
+		}
+		journal.seekg(0, std::ios::end);
+		int64_t size = journal.tellg();
+		std::vector<unsigned char> data = FileSection::read(&journal, JOURNAL_HEADER_SIZE, size - JOURNAL_HEADER_SIZE);
+		for(int offset = 0; offset + JOURNAL_RECORD_SIZE <= data.size(); offset += JOURNAL_RECORD_SIZE){
+			JournalRecord record;
+			if(!JournalRecord::fromBuffer(&data, offset, &record)){break;}
+			records.push_back(record);
+		}
+		return records;
+	}
+
+	bool reset(std::string basePath, std::vector<JournalRecord> records){
+		file.close();
+		path = getPath(basePath);
+		std::string tempPath = path + SAVE_TEMP_SUFFIX;
+		{
+			std::ofstream out(tempPath, std::ios::binary);
+			BinaryWriter writer = BinaryWriter(&out);
+			writeHeader(&writer, basePath);
+			for(int i = 0; i < records.size(); i++){
+				records.at(i).writeSaveData(&writer);
+			}
+			if(!writer.flush()){return false;}
+			out.close();
+			if(out.fail()){return false;}
+		}
+		std::error_code error;
+		std::filesystem::rename(tempPath, path, error);
+		if(error){return false;}
+		file.open(path, std::ios::binary | std::ios::app);
+		this->records = records;
+		return file.is_open();
 	}
 
+	void append(JournalRecord record){
+		if(!file.is_open()){return;}
+		recordWriter.buffer.clear();
+		record.writeSaveData(&recordWriter);
+		file.write(reinterpret_cast<const char*>(recordWriter.buffer.data()), recordWriter.buffer.size());
+		file.flush();
+		records.push_back(record);
+	}
 };
 
-struct Level {
-	int parentId;
-	cv::Mat backgroundImage;
-	std::vector<Marker> markers = {};
+struct TiledBackground{
+	std::vector<std::vector<SDL_Texture*>> tiles = {};
+	std::vector<int> columns = {};
+	std::vector<int> rows = {};
 
-	Level(): backgroundImage(){}
-	Level(cv::Mat backgroundimage, int parentId){
-		this->backgroundImage = backgroundimage;
-		this->parentId = parentId;
+	TiledBackground() {}
+
+	static Uint32 getPixelFormat(cv::Mat* image){
+		if(image->channels() == 4){return SDL_PIXELFORMAT_ARGB8888;}
+		return SDL_PIXELFORMAT_BGR24;
 	}
 
-	std::vector<unsigned char> getSaveData(){
-		std::vector<unsigned char> data = {};
-		addVectors(data, intToBytes(parentId));
-		addVectors(data, intToBytes(markers.size()));
-		std::vector<unsigned char> imageData = {};
-		cv::imencode(".png", backgroundImage, imageData, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, 9});
-		addVectors(data, intToBytes(imageData.size()));
-		addVectors(data, imageData);
-		for(int i = 0; i < markers.size(); i++){
-			addVectors(data, markers.at(i).getSaveData());
+	size_t upload(SDL_Renderer* renderer, std::vector<cv::Mat>* pyramid){
+		size_t uploadedBytes = 0;
+		destroy();
+		for(int l = 0; l < pyramid->size(); l++){
+			cv::Mat* image = &pyramid->at(l);
+			int cols = (image->cols + BACKGROUND_TILE_SIZE - 1)/BACKGROUND_TILE_SIZE;
+			int rowCount = (image->rows + BACKGROUND_TILE_SIZE - 1)/BACKGROUND_TILE_SIZE;
+			std::vector<SDL_Texture*> levelTiles = {};
+			for(int ty = 0; ty < rowCount; ty++){
+				for(int tx = 0; tx < cols; tx++){
+					int w = std::min(BACKGROUND_TILE_SIZE, image->cols - tx*BACKGROUND_TILE_SIZE);
+					int h = std::min(BACKGROUND_TILE_SIZE, image->rows - ty*BACKGROUND_TILE_SIZE);
+					SDL_Texture* tile = SDL_CreateTexture(renderer, getPixelFormat(image), SDL_TEXTUREACCESS_STATIC, w, h);
+					if(tile != NULL){
+						SDL_UpdateTexture(tile, NULL, image->ptr(ty*BACKGROUND_TILE_SIZE) + tx*BACKGROUND_TILE_SIZE*image->elemSize(), image->step);
+						SDL_SetTextureScaleMode(tile, SDL_ScaleModeLinear);
+						uploadedBytes += (size_t)w*h*image->elemSize();
+					}
+					levelTiles.push_back(tile);
+				}
+			}
+			tiles.push_back(levelTiles);
+			columns.push_back(cols);
+			rows.push_back(rowCount);
 		}
-		return data;
+		return uploadedBytes;
+	}
 
+	void destroy(){
+		for(int l = 0; l < tiles.size(); l++){
+			for(int i = 0; i < tiles.at(l).size(); i++){
+				if(tiles.at(l).at(i) != NULL){SDL_DestroyTexture(tiles.at(l).at(i));}
+			}
+		}
+		tiles = {};
+		columns = {};
+		rows = {};
 	}
 
-	static Level fromBuffer(std::vector<unsigned char>* data, int offset){
-		Level level = Level();
+	int render(SDL_Renderer* renderer, Camera* camera, std::vector<cv::Mat>* pyramid){
+		int drawCalls = 0;
+		int l = camera->getPyramidLevel(tiles.size());
+		cv::Mat* image = &pyramid->at(l);
+		float xRatio = (float)image->cols/(float)pyramid->at(0).cols;
+		float yRatio = (float)image->rows/(float)pyramid->at(0).rows;
+		float xScale = camera->getXScaleFactor()/xRatio;
+		float yScale = camera->getYScaleFactor()/yRatio;
+		float left = (float)camera->position.x*xRatio;
+		float top = (float)camera->position.y*yRatio;
+
+		int firstColumn = std::max(0, (int)(left/BACKGROUND_TILE_SIZE));
+		int firstRow = std::max(0, (int)(top/BACKGROUND_TILE_SIZE));
+		int lastColumn = std::min(columns.at(l)-1, (int)((left + (float)camera->width*xRatio)/BACKGROUND_TILE_SIZE));
+		int lastRow = std::min(rows.at(l)-1, (int)((top + (float)camera->height*yRatio)/BACKGROUND_TILE_SIZE));
+
+		for(int ty = firstRow; ty <= lastRow; ty++){
+			for(int tx = firstColumn; tx <= lastColumn; tx++){
+				SDL_Texture* tile = tiles.at(l).at(ty*columns.at(l) + tx);
+				if(tile == NULL){continue;}
+				int w = std::min(BACKGROUND_TILE_SIZE, image->cols - tx*BACKGROUND_TILE_SIZE);
+				int h = std::min(BACKGROUND_TILE_SIZE, image->rows - ty*BACKGROUND_TILE_SIZE);
+				SDL_FRect rect = {
+					((float)(tx*BACKGROUND_TILE_SIZE) - left)*xScale,
+					((float)(ty*BACKGROUND_TILE_SIZE) - top)*yScale,
+					(float)w*xScale,
+					(float)h*yScale
+				};
+				SDL_RenderCopyF(renderer, tile, NULL, &rect);
+				drawCalls++;
+			}
+		}
+		return drawCalls;
+	}
+};
+
+struct FrameProfiler{
+	std::vector<std::string> phaseNames = {};
+	std::vector<double> phaseTimes = {};
+	Uint64 phaseStart = 0;
+
+	size_t uploadBytes = 0;
+	int drawCalls = 0;
+	int markersDrawn = 0;
+
+	std::vector<std::vector<double>> history = {};
+	int historyIndex = 0;
+	int historySize = 0;
+	std::vector<Uint32> frameTicks = {};
 
-		level.parentId = intFromBytes(data, offset);
-		int markerCount = intFromBytes(data, offset + 4);
-		int imageSize = intFromBytes(data, offset + 8);
+	bool isOverlayVisible = false;
+
+	FrameProfiler(){
+		phaseNames = {"events", "updateGUI", "background", "markers", "gui", "present"};
+		phaseTimes = std::vector<double>(PHASE_COUNT, 0.0);
+		history = std::vector<std::vector<double>>(PHASE_COUNT + 3, std::vector<double>(PROFILER_WINDOW, 0.0));
+	}
+
+	void begin(){
+		phaseStart = SDL_GetPerformanceCounter();
+	}
 
-		std::vector<unsigned char> imageBuffer(data->begin() + offset + 12, data->begin() + offset + 12 + imageSize);
+	void end(int phase){
+		Uint64 now = SDL_GetPerformanceCounter();
+		phaseTimes.at(phase) += (double)(now - phaseStart)*1000.0/(double)SDL_GetPerformanceFrequency();
+		phaseStart = now;
+	}
 
-		level.backgroundImage = cv::imdecode(imageBuffer, cv::IMREAD_UNCHANGED);
+	void addUpload(size_t bytes){uploadBytes += bytes;}
+	void addDrawCalls(int count){drawCalls += count;}
+	void addMarkersDrawn(int count){markersDrawn += count;}
 
-		int cursor = offset + 12 + imageSize;
-		for(int i = 0; i < markerCount; i++){
-			level.markers.push_back(Marker::fromBuffer(data, cursor));
-			int markerLabelSize = intFromBytes(data, cursor+22);
-			cursor += 26 + markerLabelSize;
+	void endFrame(){
+		for(int i = 0; i < PHASE_COUNT; i++){
+			history.at(i).at(historyIndex) = phaseTimes.at(i);
+			phaseTimes.at(i) = 0.0;
+		}
+		history.at(PHASE_COUNT).at(historyIndex) = (double)uploadBytes/1024.0;
+		history.at(PHASE_COUNT+1).at(historyIndex) = drawCalls;
+		history.at(PHASE_COUNT+2).at(historyIndex) = markersDrawn;
+		uploadBytes = 0;
+		drawCalls = 0;
+		markersDrawn = 0;
+
+		historyIndex = (historyIndex + 1) % PROFILER_WINDOW;
+		historySize = std::min(historySize + 1, PROFILER_WINDOW);
+
+		Uint32 now = SDL_GetTicks();
+		frameTicks.push_back(now);
+		while(!frameTicks.empty() && now - frameTicks.front() > 1000){
+			frameTicks.erase(frameTicks.begin());
 		}
+	}
 
-		return level;
+	std::string formatStats(std::string name, int metric){
+		std::vector<double> values(history.at(metric).begin(), history.at(metric).begin() + historySize);
+		double minimum = 0;
+		double average = 0;
+		double p99 = 0;
+		if(!values.empty()){
+			std::sort(values.begin(), values.end());
+			minimum = values.front();
+			for(int i = 0; i < values.size(); i++){average += values.at(i);}
+			average /= values.size();
+			p99 = values.at(std::max(0, (int)std::ceil(0.99*values.size())-1));
+		}
+		char line[128];
+		snprintf(line, sizeof(line), "%-10s %8.2f %8.2f %8.2f", name.c_str(), minimum, average, p99);
+		return std::string(line);
 	}
 
+	std::vector<std::string> getReport(){
+		std::vector<std::string> lines = {};
+		lines.push_back("fps: " + std::to_string(frameTicks.size()) + "  frames: " + std::to_string(historySize));
+		lines.push_back("           min      avg      p99");
+		for(int i = 0; i < PHASE_COUNT; i++){
+			lines.push_back(formatStats(phaseNames.at(i) + " ms", i));
+		}
+		lines.push_back(formatStats("upload KB", PHASE_COUNT));
+		lines.push_back(formatStats("draws", PHASE_COUNT+1));
+		lines.push_back(formatStats("markers", PHASE_COUNT+2));
+		return lines;
+	}
 };
 
-
 struct Scene{
 	float zoomSpeed = -0.1f;
 
@@ -659,6 +2907,25 @@ struct Scene{
 	int baseZoomCameraHeight;
 
 	int currentLevel = 0;
+	LevelResidency residency;
+	std::shared_ptr<LevelPrefetcher> prefetcher;
+	std::shared_ptr<SaveWorker> saveWorker;
+	std::string savePath = "";
+	std::string saveStatus = "";
+	Uint32 saveStatusTicks = 0;
+
+	EditJournal journal;
+	int journalSnapshotRecords = 0;
+	bool isCompactionDue = false;
+	int typingLevel = -1;
+	int typingMarkerIndex = -1;
+
+	SDL_Texture* placeholderTexture = NULL;
+	int placeholderLevel = -1;
+
+	int backgroundMode = BACKGROUND_MODE_CPU;
+	TiledBackground backgroundTiles;
+	int backgroundTilesLevel = -1;
 
 	bool isMouseLeftDown = false;
 	bool isUnhandledLeftMouseClick = false;
@@ -671,10 +2938,27 @@ struct Scene{
 	bool isShiftDown = false;
 	bool isTyping = false;
 	bool isUnhandledEscape = false;
+	bool isUnhandledHover = false;
 	bool isCTRLDown = false;
 	bool isSDown = false;
+	bool isDirty = true;
 
-	Marker* selectedMarker;
+	int frameCap = DEFAULT_FRAME_CAP;
+
+	bool isProgressiveResampling = true;
+	bool isBackgroundRefined = true;
+	Uint32 lastInteractionTicks = 0;
+	Camera lastCamera;
+
+	bool isAsyncBackground = true;
+	bool isScrollReuse = true;
+	std::shared_ptr<BackgroundWorker> backgroundWorker;
+	BackgroundRequest lastBackgroundRequest;
+	BackgroundRequest displayedBackground;
+
+	FrameProfiler profiler;
+
+	int selectedMarkerIndex = -1;
 	int rightClickedMarkerIndex = -1;
 
 	float zoomFactor = 1.0f;
@@ -691,16 +2975,22 @@ struct Scene{
 
 	GuiScrollComponent colorDisplayScroll;
 
-	SDL_Texture* texture;
-	SDL_Texture* iconTexture;
+	SDL_Texture* texture = NULL;
+	int textureWidth = 0;
+	int textureHeight = 0;
+	BackgroundResampler resampler;
+	SDL_Texture* iconAtlas;
+	QuadBatch iconBatch;
 
-	SDL_Texture* textTexture;
-	SDL_Texture* menuTexture;
+	GlyphAtlas labelFont;
+	GlyphAtlas menuFont;
 
 	LeftCLickMenu lClickMenu;
 
 	std::vector<cv::Mat> icons = {};
 	std::unordered_map<int, int> marker_icons_map;
+	std::vector<SDL_Rect> iconAtlasRects = {};
+	SDL_Rect fallBackIconRect;
 	std::vector<std::tuple<int, int>> marker_icons = {};
 	std::string typedText = "";
 	std::vector<Level> levels = {};
@@ -732,7 +3022,9 @@ struct Scene{
 	}
 
 	Level getDefaultLevel(){
-		return Level(getImageFromUser(), -1);
+		std::shared_ptr<EncodedImage> encodedImage;
+		cv::Mat image = getImageFromUser(&encodedImage);
+		return Level::fromImage(image, -1, encodedImage);
 	}
 
 	void resetGui(){
@@ -765,13 +3057,13 @@ struct Scene{
 		lowestIconScroll.scroll(-2);
 	}
 
-	void renderIconScrollComponents(SDL_Renderer* renderer){
+	void renderIconScrollComponents(QuadBatch* batch){
 		Color color = Color(ColorRedScroll.scrollIndex, ColorGreenScroll.scrollIndex, ColorBlueScroll.scrollIndex);
-		uppermostIconScroll.render(renderer, iconTexture, &icons.at(std::get<0>(marker_icons.at(uppermostIconScroll.scrollIndex))), color);
-		upperIconScroll.render(renderer, iconTexture, &icons.at(std::get<0>(marker_icons.at(upperIconScroll.scrollIndex))), color);
-		primaryIconScroll.render(renderer, iconTexture, &icons.at(std::get<0>(marker_icons.at(primaryIconScroll.scrollIndex))), color);
-		lowerIconScroll.render(renderer, iconTexture, &icons.at(std::get<0>(marker_icons.at(lowerIconScroll.scrollIndex))), color);
-		lowestIconScroll.render(renderer, iconTexture, &icons.at(std::get<0>(marker_icons.at(lowestIconScroll.scrollIndex))), color);
+		uppermostIconScroll.render(batch, iconAtlasRects.at(std::get<0>(marker_icons.at(uppermostIconScroll.scrollIndex))), color);
+		upperIconScroll.render(batch, iconAtlasRects.at(std::get<0>(marker_icons.at(upperIconScroll.scrollIndex))), color);
+		primaryIconScroll.render(batch, iconAtlasRects.at(std::get<0>(marker_icons.at(primaryIconScroll.scrollIndex))), color);
+		lowerIconScroll.render(batch, iconAtlasRects.at(std::get<0>(marker_icons.at(lowerIconScroll.scrollIndex))), color);
+		lowestIconScroll.render(batch, iconAtlasRects.at(std::get<0>(marker_icons.at(lowestIconScroll.scrollIndex))), color);
 
 	}
 
@@ -799,36 +3091,80 @@ struct Scene{
 		return im;
 	}
 
-	static Scene createSceneFromImage(cv::Mat image){
+	static Scene createSceneFromImage(cv::Mat image, std::shared_ptr<EncodedImage> encodedImage = NULL){
 		int minRes = std::min(image.cols, image.rows);
 		LOG("Here 984156");
 		Scene scene = Scene(
 			Window(500, 500, "Default Scene"),
 			Camera(CoordInt(0, 0), minRes, minRes, 500, 500)
 		);
-		scene.addLevel(Level(image, -1));
+		scene.addLevel(Level::fromImage(image, -1, encodedImage));
 		LOG("Here 789987");
 		return scene;
 	}
 
 	static Scene getDefaultScene(){
-		return createSceneFromImage(getImageFromUser());
+		std::shared_ptr<EncodedImage> encodedImage;
+		cv::Mat image = getImageFromUser(&encodedImage);
+		return createSceneFromImage(image, encodedImage);
 	}
 
 	void addLevel(Level level){
 		levels.push_back(level);
 	}
 
+	void openLevel(int level){
+		installPrefetchedLevels();
+		currentLevel = level;
+		if(!levels.at(currentLevel).isResident()){
+			if(!prefetcher){levels.at(currentLevel).ensureResident();}
+			else{prefetchLevel(currentLevel);}
+		}
+		residency.touch(currentLevel);
+		residency.enforce(&levels, currentLevel);
+		prefetchLevel(levels.at(currentLevel).parentId);
+		resetGui();
+	}
+
+	void prefetchLevel(int level){
+		if(!prefetcher || level < 0 || level >= levels.size()){return;}
+		if(levels.at(level).isResident()){return;}
+		prefetcher->request(level, levels.at(level).encodedImage);
+	}
+
+	void prefetchMarkerLink(int markerIndex){
+		if(markerIndex < 0){return;}
+		prefetchLevel(levels.at(currentLevel).markers.at(markerIndex).levelLink);
+	}
+
+	void installPrefetchedLevels(){
+		if(!prefetcher){return;}
+		std::vector<PrefetchedLevel> done = prefetcher->takeFinished();
+		for(int i = 0; i < done.size(); i++){
+			Level* level = &levels.at(done.at(i).level);
+			if(level->isResident() || level->encodedImage != done.at(i).source){continue;}
+			level->installPyramid(done.at(i).pyramid);
+			residency.touch(done.at(i).level);
+			if(done.at(i).level == currentLevel){markDirty();}
+		}
+		if(!done.empty()){residency.enforce(&levels, currentLevel);}
+	}
+
 	void startTyping(){
 		if(!isTyping){
 			SDL_StartTextInput();
 			typedText = "";
 			isTyping = true;
+			typingLevel = currentLevel;
+			typingMarkerIndex = rightClickedMarkerIndex;
 		}
 	}
 
 	void stopTyping(){
 		if(isTyping){
+			if(typingMarkerIndex >= 0 && typingMarkerIndex < levels.at(typingLevel).markers.size()){
+				journalLabel(typingLevel, typingMarkerIndex);
+			}
 			SDL_StopTextInput();
 			typedText = "";
 			isTyping = false;
@@ -838,11 +3174,22 @@ struct Scene{
 	int init(std::string path){
 		loadIcons(path);
 		int res = w.init();
-		texture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_BGR24, SDL_TEXTUREACCESS_STATIC, camera.renderWidth, camera.renderHeight);
-		iconTexture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, ICON_RES, ICON_RES);
-		textTexture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, TEXT_WIDTH, TEXT_HEIGHT);
-
-		menuTexture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, MENU_OPTIONWIDTH, MENU_OPTIONHEIGHT);
+		openJournal();
+		residency.touch(currentLevel);
+		ensureBackgroundTexture();
+		backgroundWorker = std::make_shared<BackgroundWorker>();
+		backgroundWorker->start(SDL_RegisterEvents(1));
+		prefetcher = std::make_shared<LevelPrefetcher>();
+		prefetcher->start(SDL_RegisterEvents(1));
+		saveWorker = std::make_shared<SaveWorker>();
+		saveWorker->setEventType(SDL_RegisterEvents(1));
+		prefetchLevel(levels.at(currentLevel).parentId);
+		buildIconAtlas();
+
+		labelFont = GlyphAtlas(LABEL_FONT, LABEL_FONT_SCALE, LABEL_FONT_THICKNESS);
+		labelFont.upload(w.renderer);
+		menuFont = GlyphAtlas(LABEL_FONT, MENU_FONT_SCALE, MENU_FONT_THICKNESS);
+		menuFont.upload(w.renderer);
 
 		uppermostIconScroll = GuiScrollComponent(CoordInt(0, 0), marker_icons.size());
 		upperIconScroll = GuiScrollComponent(CoordInt(0, 50), marker_icons.size());
@@ -873,27 +3220,155 @@ struct Scene{
 		return res;
 	}
 
-	std::vector<unsigned char> getSaveData(){
-		std::vector<unsigned char> data = {};
-		addVectors(data, intToBytes(FILE_FORMAT_VERSION));
-		addVectors(data, intToBytes(levels.size()));
-		for(int i = 0; i < levels.size(); i++){
-			addVectors(data, levels.at(i).getSaveData());
+	void buildIconAtlas(){
+		int count = icons.size()+1;
+		int columns = std::ceil(std::sqrt((float)count));
+		int rows = (count + columns - 1)/columns;
+		cv::Mat atlas = cv::Mat(rows*ICON_RES, columns*ICON_RES, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+
+		iconAtlasRects = {};
+		for(int i = 0; i < count; i++){
+			cv::Mat* icon = i < icons.size() ? &icons.at(i) : &fallBackIcon;
+			SDL_Rect rect = {(i%columns)*ICON_RES, (i/columns)*ICON_RES, ICON_RES, ICON_RES};
+			cv::Mat cell = atlas(cv::Rect(rect.x, rect.y, rect.w, rect.h));
+			if(icon->channels() == 4){icon->copyTo(cell);}
+			else if(icon->channels() == 3){cv::cvtColor(*icon, cell, cv::COLOR_BGR2BGRA);}
+			if(i < icons.size()){iconAtlasRects.push_back(rect);}
+			else{fallBackIconRect = rect;}
 		}
-		return data;
+
+		iconAtlas = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, atlas.cols, atlas.rows);
+		SDL_UpdateTexture(iconAtlas, NULL, atlas.data, atlas.step);
+		SDL_SetTextureBlendMode(iconAtlas, SDL_BLENDMODE_BLEND);
+		iconBatch = QuadBatch(atlas.cols, atlas.rows);
 	}
 
-	int saveData(){
-		std::string filePath = getSaveFileFromUser(std::vector<std::string>{FILE_EXTENSION});
+	int saveData(bool askForPath){
+		std::string filePath = savePath;
+		if(askForPath || filePath.empty()){filePath = getSaveFileFromUser(std::vector<std::string>{FILE_EXTENSION});}
 		if(filePath.empty()){return -1;}
-		std::ofstream file(filePath, std::ios::binary);
-		if(!file){return -1;}
-		std::vector<unsigned char> data = getSaveData();
-		file.write(reinterpret_cast<const char*> (data.data()), data.size());
-		file.close();
+		if(saveWorker->isBusy()){
+			setSaveStatus("Save already in progress");
+			return -1;
+		}
+
+		std::vector<Level> snapshot = {};
+		for(int i = 0; i < levels.size(); i++){
+			snapshot.push_back(levels.at(i).getSnapshot());
+		}
+		if(!saveWorker->start(snapshot, filePath)){return -1;}
+		journalSnapshotRecords = journal.records.size();
+		setSaveStatus("Saving " + std::filesystem::path(filePath).filename().string() + "...");
 		return 1;
 	}
 
+	void openJournal(){
+		if(savePath.empty()){return;}
+		std::vector<JournalRecord> records = EditJournal::read(savePath);
+		int applied = 0;
+		int lost = 0;
+		std::string label = "";
+		for(int i = 0; i < records.size(); i++){
+			if(applyJournalRecord(&records.at(i), &label)){applied++;}
+			else{lost++;}
+		}
+		journal.reset(savePath, records);
+		if(lost > 0){
+			LOG("could not apply " << lost << " edits from " << journal.path);
+			setSaveStatus("Recovered " + std::to_string(applied) + " unsaved edits, " + std::to_string(lost) + " could not be restored");
+		}
+		else if(applied > 0){
+			LOG("recovered " << applied << " edits from " << journal.path);
+			setSaveStatus("Recovered " + std::to_string(applied) + " unsaved edits");
+		}
+	}
+
+	bool applyJournalRecord(JournalRecord* record, std::string* label){
+		// Only written by older builds; the level's image was never journaled, so it cannot be rebuilt.
+		if(record->op == JOURNAL_ADD_LEVEL){
+			LOG("journal: level " << record->level << " was added after the last save and cannot be restored");
+			return false;
+		}
+		if(record->level < 0 || record->level >= levels.size()){return false;}
+		Level* level = &levels.at(record->level);
+		bool isMarkerValid = record->index >= 0 && record->index < level->markers.size();
+		if(record->op == JOURNAL_ADD_MARKER && record->index == level->markers.size()){
+			std::vector<unsigned char>* p = &record->payload;
+			level->addMarker(Marker(CoordInt(record->a, record->b), Color(p->at(0), p->at(1), p->at(2)), Color(p->at(3), p->at(4), p->at(5)), "", record->c, ICON_RES/2));
+			return true;
+		}
+		if(record->op == JOURNAL_MOVE_MARKER && isMarkerValid){
+			level->moveMarker(record->index, CoordInt(record->a, record->b));
+			return true;
+		}
+		if(record->op == JOURNAL_RELABEL_MARKER && isMarkerValid){
+			if(record->b == 0){label->clear();}
+			label->append(record->payload.begin(), record->payload.begin() + std::max(0, std::min(record->c, JOURNAL_PAYLOAD_SIZE)));
+			if(label->size() >= record->a){level->markers.at(record->index).UpdateLabel(*label);}
+			return true;
+		}
+		if(record->op == JOURNAL_DELETE_MARKER && isMarkerValid){
+			level->removeMarker(record->index);
+			return true;
+		}
+		if(record->op == JOURNAL_LINK_MARKER && isMarkerValid && record->a < (int)levels.size()){
+			level->markers.at(record->index).levelLink = record->a;
+			return true;
+		}
+		return false;
+	}
+
+	void journalEdit(JournalRecord record){
+		if(!journal.isOpen()){return;}
+		journal.append(record);
+		if(journal.records.size() >= JOURNAL_COMPACT_RECORDS){isCompactionDue = true;}
+	}
+
+	void journalLabel(int level, int index){
+		std::string label = levels.at(level).markers.at(index).label;
+		for(int start = 0; start == 0 || start < label.size(); start += JOURNAL_PAYLOAD_SIZE){
+			JournalRecord record = JournalRecord(JOURNAL_RELABEL_MARKER, level, index, label.size(), start, std::min(JOURNAL_PAYLOAD_SIZE, (int)label.size() - start));
+			std::copy(label.begin() + start, label.begin() + start + record.c, record.payload.begin());
+			journalEdit(record);
+		}
+	}
+
+	void journalNewMarker(int level, int index){
+		Marker* marker = &levels.at(level).markers.at(index);
+		JournalRecord record = JournalRecord(JOURNAL_ADD_MARKER, level, index, marker->position.x, marker->position.y, marker->iconId);
+		std::vector<unsigned char> colors = {marker->color.r, marker->color.g, marker->color.b, marker->labelColor.r, marker->labelColor.g, marker->labelColor.b};
+		std::copy(colors.begin(), colors.end(), record.payload.begin());
+		journalEdit(record);
+		journalLabel(level, index);
+	}
+
+	void journalMarkerMove(int level, int index){
+		Marker* marker = &levels.at(level).markers.at(index);
+		journalEdit(JournalRecord(JOURNAL_MOVE_MARKER, level, index, marker->position.x, marker->position.y));
+	}
+
+	void setSaveStatus(std::string status){
+		saveStatus = status;
+		saveStatusTicks = SDL_GetTicks();
+		markDirty();
+	}
+
+	void handleSaveResult(){
+		bool success;
+		std::string path;
+		if(!saveWorker || !saveWorker->takeResult(&success, &path)){return;}
+		std::string name = std::filesystem::path(path).filename().string();
+		if(success){
+			savePath = path;
+			std::vector<JournalRecord> tail(journal.records.begin() + std::min(journalSnapshotRecords, (int)journal.records.size()), journal.records.end());
+			journal.reset(savePath, tail);
+			setSaveStatus("Saved " + name);
+		}
+		else{
+			setSaveStatus("Failed to save " + name);
+		}
+	}
+
 	static std::vector<unsigned char> readFileBuffer(std::string filePath){
 		std::vector<unsigned char> data = {};
 		std::ifstream file(filePath, std::ios::binary);
@@ -901,53 +3376,107 @@ struct Scene{
 		if(!file.is_open()){return data;}
 
 		file.seekg(0, std::ios::end);
-		int fileSize = file.tellg();
+		int64_t fileSize = file.tellg();
 		file.seekg(std::ios::beg);
+		if(fileSize <= 0){return data;}
 
-		char* buffer = new char[fileSize];
-		file.read(buffer, fileSize);
-		file.close();
-
-		for(int i = 0; i < fileSize; i++){
-			data.push_back(buffer[i]);
-		}
-
-		delete[] buffer;
+		data.resize(fileSize);
+		file.read(reinterpret_cast<char*>(data.data()), fileSize);
+		if(file.gcount() != fileSize){data.clear();}
 		return data;
 	}
 
-	static Scene sceneFromFile(std::string path){
-		std::vector<unsigned char> data = readFileBuffer(path);
-		int levelCount = intFromBytes(&data, 4);
+	static std::vector<std::vector<FileSection>> readLevelTable(ByteView* file, int levelCount){
+		std::vector<std::vector<FileSection>> table = {};
+		BinaryReader reader = BinaryReader(*file, FILE_HEADER_SIZE);
+		if(!reader.hasBytes((int64_t)levelCount*LEVEL_SECTION_COUNT*SECTION_ENTRY_SIZE)){return table;}
+		for(int i = 0; i < levelCount; i++){
+			std::vector<FileSection> sections = {};
+			for(int j = 0; j < LEVEL_SECTION_COUNT; j++){
+				sections.push_back(FileSection::fromBuffer(&reader));
+			}
+			table.push_back(sections);
+		}
+		return table;
+	}
 
+	static std::vector<Level> levelsFromFile(std::string path, int levelCount){
 		std::vector<Level> levels = {};
-
-		int cursor = 8;
+		if(levelCount <= 0){return levels;}
+		std::shared_ptr<SharedMapping> mapping = SharedMapping::open(path);
+		if(mapping == NULL){
+			LOG("could not map " << path);
+			return {};
+		}
+		ByteView file = ByteView(mapping->file.data, mapping->file.size);
+		std::vector<std::vector<FileSection>> table = readLevelTable(&file, levelCount);
+		if(table.size() != levelCount){
+			LOG("corrupt level table in " << path);
+			return {};
+		}
+		levels.resize(levelCount);
+		std::vector<char> isLoaded(levelCount, 0);
+		parallelFor(levelCount, [&](int i){
+			isLoaded.at(i) = Level::fromChunk(mapping, table.at(i), i == 0, &levels.at(i));
+		});
 		for(int i = 0; i < levelCount; i++){
-			levels.push_back(Level::fromBuffer(&data, cursor));
-			int imageSize = intFromBytes(&data, cursor + 8);
-
-			int markerCount = intFromBytes(&data, cursor + 4);
-			int markerCursor = cursor +	12 + imageSize;
-			int sizeofMarkers = 0;
-			for(int j = 0; j < markerCount; j++){
-				int sizeofMarker = 26 + intFromBytes(&data, markerCursor + 22);
-				sizeofMarkers += sizeofMarker;
-				markerCursor += sizeofMarker;
+			if(!isLoaded.at(i)){
+				LOG("corrupt level " << i << " in " << path);
+				return {};
 			}
+		}
+		return levels;
+	}
 
-			cursor += 12 + imageSize + sizeofMarkers;
+	static std::vector<Level> levelsFromV1File(std::string path){
+		std::shared_ptr<SharedMapping> mapping = SharedMapping::open(path);
+		if(mapping == NULL){
+			LOG("could not map " << path);
+			return {};
 		}
-		
+		BinaryReader reader = BinaryReader(ByteView(mapping->file.data, mapping->file.size), 4);
+		int levelCount = reader.getInt();
+		if(levelCount <= 0 || !reader.hasBytes((int64_t)levelCount*12)){return {};}
+
+		// Level offsets depend on the previous level's markers, so the records are
+		// walked once in order. Images stay in the mapping; only the first level
+		// is decoded now.
+		std::vector<Level> levels(levelCount);
+		for(int i = 0; i < levelCount; i++){
+			if(!Level::fromBuffer(&reader, mapping, &levels.at(i))){
+				LOG("truncated level " << i << " in " << path);
+				return {};
+			}
+		}
+		levels.at(0).ensureResident();
+		return levels;
+	}
+
+	static Scene sceneFromFile(std::string path){
+		std::ifstream file(path, std::ios::binary);
+		std::vector<unsigned char> header = FileSection::read(&file, 0, FILE_HEADER_SIZE);
+		file.close();
+		if(header.size() != FILE_HEADER_SIZE){return Scene();}
+		int version = intFromBytes(&header, 0);
+		int levelCount = intFromBytes(&header, 4);
+
+		std::vector<Level> levels = {};
+		if(version == FILE_FORMAT_VERSION){levels = levelsFromFile(path, levelCount);}
+		else if(version >= FILE_FORMAT_VERSION_V1_MIN && version <= FILE_FORMAT_VERSION_V1){levels = levelsFromV1File(path);}
+		else{LOG("unsupported file version " << version << " in " << path);}
+		if(levels.empty()){return Scene();}
+
 		std::filesystem::path filePath(path);
-		int cameraSize = std::min(levels.at(0).backgroundImage.cols, levels.at(0).backgroundImage.rows);
+		int cameraSize = std::min(levels.at(0).getWidth(), levels.at(0).getHeight());
 		Scene scene = Scene(Window(500, 500, filePath.filename().string()), Camera(CoordInt(0, 0), cameraSize, cameraSize, 500, 500));
 		scene.levels = levels;
+		scene.savePath = path;
 		return scene;
 	}
 
-	static cv::Mat getImageFromUser(){
+	static cv::Mat getImageFromUser(std::shared_ptr<EncodedImage>* encodedImage = NULL){
 		cv::Mat image;
+		std::vector<unsigned char> bytes;
 		std::string path = "";
 
 	read_again:
@@ -957,9 +3486,11 @@ struct Scene{
 		if(!std::filesystem::exists(path)){goto read_again;}
 
 		std::cout << "here 1323: " << path << std::endl;
-		image = cv::imread(path, cv::IMREAD_COLOR);
+		bytes = readFileBuffer(path);
+		image = cv::imdecode(bytes, LEVEL_IMAGE_READ_FLAGS);
 
 		if(image.empty()){goto read_again;}
+		if(encodedImage != NULL){*encodedImage = std::make_shared<EncodedImage>(bytes);}
 
 		std::cout << path << std::endl;
 		LOG(image.empty())
@@ -1027,7 +3558,7 @@ struct Scene{
 	}
 
 	void addMarker(Marker marker){
-		levels.at(currentLevel).markers.push_back(marker);
+		levels.at(currentLevel).addMarker(marker);
 	}
 
 	void alignCameraAspectRatio(){
@@ -1036,11 +3567,57 @@ struct Scene{
 		baseZoomCameraHeight = std::round((float)camera.renderHeight*factor);
 	}
 
+	void markDirty(){
+		isDirty = true;
+	}
+
+	bool isWindowVisible(){
+		Uint32 flags = SDL_GetWindowFlags(w.window);
+		return !(flags & (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN));
+	}
+
+	bool isRefinementDue(){
+		return !isBackgroundRefined && SDL_GetTicks() - lastInteractionTicks >= REFINE_IDLE_MS;
+	}
+
+	bool needsRender(){
+		return (isDirty || isRefinementDue()) && isWindowVisible();
+	}
+
+	Uint32 getFrameInterval(){
+		if(frameCap <= 0){return 0;}
+		return 1000/frameCap;
+	}
+
+	int getEventTimeout(Uint32 lastFrame){
+		if(needsRender()){
+			return std::max(0, (int)(lastFrame + getFrameInterval()) - (int)SDL_GetTicks());
+		}
+		// Refinement only happens in render(), which a hidden window never reaches.
+		if(!isBackgroundRefined && isWindowVisible()){
+			return std::max(1, (int)(lastInteractionTicks + REFINE_IDLE_MS) - (int)SDL_GetTicks());
+		}
+		return IDLE_WAIT_MS;
+	}
+
+	int getBackgroundFilter(){
+		if(!isProgressiveResampling){return BACKGROUND_DEFAULT_FILTER;}
+		if(SDL_GetTicks() - lastInteractionTicks < REFINE_IDLE_MS){return BACKGROUND_FAST_FILTER;}
+		return BACKGROUND_QUALITY_FILTER;
+	}
+
 	void handleEvent(SDL_Event event){
 		if(event.type == SDL_QUIT){
 			w.quit = true;
 		}
 
+		if(event.type == SDL_MOUSEMOTION){
+			if(isMouseLeftDown || isMarkerSelected){markDirty();}
+		}
+		else{
+			markDirty();
+		}
+
 		if(isTyping){
 			if(event.type == SDL_KEYDOWN){
 				if(event.key.keysym.sym == SDLK_KP_ENTER || event.key.keysym.sym == SDLK_RETURN){
@@ -1087,12 +3664,10 @@ struct Scene{
 				SDL_GetMouseState(
 					&(mousePosition.x),
 					&(mousePosition.y));
-				for(int i = 0; i < levels.at(currentLevel).markers.size(); i++){
-					if(levels.at(currentLevel).markers.at(i).isInside(mousePosition, &camera)){
-						isMarkerSelected = true;
-						selectedMarker = &(levels.at(currentLevel).markers.at(i));
-						break;
-					}
+				int hit = levels.at(currentLevel).getTopmostMarkerAt(mousePosition, &camera);
+				if(hit >= 0){
+					isMarkerSelected = true;
+					selectedMarkerIndex = hit;
 				}
 				
 			}
@@ -1104,21 +3679,24 @@ struct Scene{
 		if(event.type == SDL_MOUSEBUTTONUP){
 			if(event.button.button == SDL_BUTTON_LEFT){isMouseLeftDown = false;}
 			if(event.button.button == SDL_BUTTON_RIGHT){isMouseRightDown = false;}
+			if(isMarkerSelected && selectedMarkerIndex >= 0 && selectedMarkerIndex < levels.at(currentLevel).markers.size()){
+				journalMarkerMove(currentLevel, selectedMarkerIndex);
+			}
 			isMarkerSelected = false;
 		}
 		if(event.type == SDL_MOUSEMOTION){
 			SDL_GetMouseState(
 				&(mousePosition.x),
 				&(mousePosition.y));
-				
+			isUnhandledHover = true;
 		}
 		if(event.type == SDL_KEYDOWN){
 			if(event.key.keysym.sym == SDLK_DELETE){
 				if(!isMarkerSelected){
-					for(int i = 0; i < levels.at(currentLevel).markers.size(); i++){
-						if(levels.at(currentLevel).markers.at(i).isInside(mousePosition, &camera)){
-							levels.at(currentLevel).markers.erase(levels.at(currentLevel).markers.begin()+i);
-						}
+					std::vector<int> hits = levels.at(currentLevel).getMarkersAt(mousePosition, &camera);
+					for(int i = hits.size()-1; i >= 0; i--){
+						journalEdit(JournalRecord(JOURNAL_DELETE_MARKER, currentLevel, hits.at(i)));
+						levels.at(currentLevel).removeMarker(hits.at(i));
 					}
 				}
 				isLeftClickMenuActive = false;
@@ -1129,6 +3707,11 @@ struct Scene{
 			}
 			if(event.key.keysym.sym == SDLK_LCTRL || event.key.keysym.sym == SDLK_RCTRL){isCTRLDown = true;}
 			if(event.key.keysym.sym == SDLK_s){isSDown = true;}
+			if(event.key.keysym.sym == SDLK_F2){toggleBackgroundMode();}
+			if(event.key.keysym.sym == SDLK_F3){profiler.isOverlayVisible = !profiler.isOverlayVisible;}
+			if(event.key.keysym.sym == SDLK_F4){isProgressiveResampling = !isProgressiveResampling;}
+			if(event.key.keysym.sym == SDLK_F5){toggleAsyncBackground();}
+			if(event.key.keysym.sym == SDLK_F6){isScrollReuse = !isScrollReuse;}
 		}
 		if(event.type == SDL_KEYUP){
 			if(event.key.keysym.sym == SDLK_LSHIFT){isShiftDown = false;}
@@ -1140,30 +3723,185 @@ struct Scene{
 	}
 
 	float getMaxZoomFactor(){
+		if(levels.at(currentLevel).getWidth() <= 0){return 1.0f;}
 		return std::min(
-			(float)levels.at(currentLevel).backgroundImage.cols/(float)baseZoomCameraWidth,
-			(float)levels.at(currentLevel).backgroundImage.rows/(float)baseZoomCameraHeight
+			(float)levels.at(currentLevel).getWidth()/(float)baseZoomCameraWidth,
+			(float)levels.at(currentLevel).getHeight()/(float)baseZoomCameraHeight
 		);
 	}
 	void renderBackground(SDL_Renderer* renderer){
-		cv::Mat image = camera.getBackgroundImage(levels.at(currentLevel).backgroundImage);
-		SDL_UpdateTexture(texture, NULL, image.data, image.cols*3);
-		SDL_RenderCopy(renderer, texture, NULL, NULL);
+		// Only the CPU resample paths draw a fast frame that needs refining later.
+		if(!levels.at(currentLevel).isResident()){
+			isBackgroundRefined = true;
+			renderPlaceholder(renderer);
+			return;
+		}
+		if(backgroundMode == BACKGROUND_MODE_TILED && !levels.at(currentLevel).isVirtual()){
+			isBackgroundRefined = true;
+			if(backgroundTilesLevel != currentLevel){
+				profiler.addUpload(backgroundTiles.upload(renderer, &levels.at(currentLevel).pyramid));
+				backgroundTilesLevel = currentLevel;
+			}
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+			SDL_RenderClear(renderer);
+			profiler.addDrawCalls(backgroundTiles.render(renderer, &camera, &levels.at(currentLevel).pyramid));
+			return;
+		}
+		if(isAsyncBackground){
+			renderBackgroundAsync(renderer);
+			return;
+		}
+		BackgroundView view = camera.getBackgroundView(levels.at(currentLevel).getPyramidSizes());
+		cv::Mat source = levels.at(currentLevel).getBackgroundSource(&view);
+		if(source.empty()){return;}
+		SDL_Rect rect = {0, 0, view.width, view.height};
+		void* pixels;
+		int pitch;
+		if(SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0){return;}
+		int filter = getBackgroundFilter();
+		isBackgroundRefined = filter != BACKGROUND_FAST_FILTER;
+		resampler.resample(&source, view, (unsigned char*)pixels, pitch, filter);
+		SDL_UnlockTexture(texture);
+		profiler.addUpload((size_t)view.width*view.height*4);
+		SDL_RenderCopy(renderer, texture, &rect, NULL);
+		profiler.addDrawCalls(1);
+	}
+
+	void renderBackgroundAsync(SDL_Renderer* renderer){
+		Level* level = &levels.at(currentLevel);
+		BackgroundView view = camera.getBackgroundView(level->getPyramidSizes());
+		int filter = getBackgroundFilter();
+		cv::Mat source = level->isVirtual() ? cv::Mat() : level->pyramid.at(view.pyramidLevel);
+		BackgroundRequest request = BackgroundRequest(source, level->virtualImage, view, camera, filter, currentLevel, isScrollReuse);
+		if(!request.isSameAs(&lastBackgroundRequest)){
+			backgroundWorker->submit(request);
+			lastBackgroundRequest = request;
+			isBackgroundRefined = filter != BACKGROUND_FAST_FILTER;
+		}
+
+		profiler.addUpload(backgroundWorker->uploadNewFrame(texture, textureWidth, textureHeight, &displayedBackground));
+
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		if(displayedBackground.level == currentLevel){
+			SDL_Rect source = {0, 0, displayedBackground.view.width, displayedBackground.view.height};
+			SDL_FRect destination = displayedBackground.getDestination(&camera);
+			SDL_RenderCopyF(renderer, texture, &source, &destination);
+			profiler.addDrawCalls(1);
+		}
+	}
 
+	void renderPlaceholder(SDL_Renderer* renderer){
+		Level* level = &levels.at(currentLevel);
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		if(level->thumbnail.empty() || level->getWidth() <= 0){return;}
+
+		if(placeholderLevel != currentLevel){
+			if(placeholderTexture != NULL){SDL_DestroyTexture(placeholderTexture);}
+			cv::Mat pixels;
+			if(level->thumbnail.channels() == 4){pixels = level->thumbnail;}
+			else if(level->thumbnail.channels() == 3){cv::cvtColor(level->thumbnail, pixels, cv::COLOR_BGR2BGRA);}
+			else{cv::cvtColor(level->thumbnail, pixels, cv::COLOR_GRAY2BGRA);}
+			placeholderTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, pixels.cols, pixels.rows);
+			if(placeholderTexture != NULL){
+				SDL_UpdateTexture(placeholderTexture, NULL, pixels.data, pixels.step);
+				SDL_SetTextureScaleMode(placeholderTexture, SDL_ScaleModeLinear);
+				profiler.addUpload((size_t)pixels.cols*pixels.rows*4);
+			}
+			placeholderLevel = currentLevel;
+		}
+		if(placeholderTexture == NULL){return;}
+
+		SDL_FRect rect = {
+			-(float)camera.position.x*camera.getXScaleFactor(),
+			-(float)camera.position.y*camera.getYScaleFactor(),
+			(float)level->getWidth()*camera.getXScaleFactor(),
+			(float)level->getHeight()*camera.getYScaleFactor()
+		};
+		SDL_RenderCopyF(renderer, placeholderTexture, NULL, &rect);
+		profiler.addDrawCalls(1);
 	}
 
-	void renderMarkers(SDL_Renderer* renderer){
-		for(int i = 0; i < levels.at(currentLevel).markers.size(); i++){
-			if(levels.at(currentLevel).markers.at(i).isVisible(&camera)){
-				cv::Mat* pt;
-				if(marker_icons_map.find(levels.at(currentLevel).markers.at(i).iconId) == marker_icons_map.end()){
-					pt = &fallBackIcon;
-				}else{
-					pt = &icons.at(marker_icons_map.at(levels.at(currentLevel).markers.at(i).iconId));
-				}
-				levels.at(currentLevel).markers.at(i).render(renderer, iconTexture, &camera, pt, textTexture, isTyping && i == rightClickedMarkerIndex);
+	void ensureBackgroundTexture(){
+		if(texture != NULL && textureWidth >= camera.renderWidth && textureHeight >= camera.renderHeight){return;}
+		if(texture != NULL){SDL_DestroyTexture(texture);}
+		textureWidth = ((std::max(camera.renderWidth, textureWidth) + BACKGROUND_TEXTURE_GRANULARITY - 1)/BACKGROUND_TEXTURE_GRANULARITY)*BACKGROUND_TEXTURE_GRANULARITY;
+		textureHeight = ((std::max(camera.renderHeight, textureHeight) + BACKGROUND_TEXTURE_GRANULARITY - 1)/BACKGROUND_TEXTURE_GRANULARITY)*BACKGROUND_TEXTURE_GRANULARITY;
+		texture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+	}
+
+	void toggleBackgroundMode(){
+		if(backgroundMode == BACKGROUND_MODE_TILED){
+			backgroundTiles.destroy();
+			backgroundTilesLevel = -1;
+			backgroundMode = BACKGROUND_MODE_CPU;
+		}
+		else{
+			backgroundMode = BACKGROUND_MODE_TILED;
+		}
+	}
+
+	SDL_Rect getIconSource(int iconId){
+		std::unordered_map<int, int>::iterator it = marker_icons_map.find(iconId);
+		if(it == marker_icons_map.end()){
+			return fallBackIconRect;
+		}
+		return iconAtlasRects.at(it->second);
+	}
+
+	std::vector<int> getVisibleMarkers(){
+		Level* level = &levels.at(currentLevel);
+
+		CoordInt labelExtent = camera.scaleFromCameraCoordinates(CoordInt(TEXT_WIDTH/2, ICON_RES/2 + TEXT_HEIGHT));
+		CoordInt iconExtent = camera.scaleFromCameraCoordinates(CoordInt(ICON_RES/2, ICON_RES/2));
+		std::vector<int> candidates = level->getMarkersInRect(
+			camera.position.x - labelExtent.x,
+			camera.position.y - iconExtent.y,
+			camera.position.x + camera.width + labelExtent.x,
+			camera.position.y + camera.height + labelExtent.y
+		);
+
+		std::vector<int> visible = {};
+		for(int i = 0; i < candidates.size(); i++){
+			if(level->markers.at(candidates.at(i)).isVisible(&camera)){
+				visible.push_back(candidates.at(i));
 			}
 		}
+		return visible;
+	}
+
+	void toggleAsyncBackground(){
+		isAsyncBackground = !isAsyncBackground;
+		lastBackgroundRequest = BackgroundRequest();
+		displayedBackground = BackgroundRequest();
+	}
+
+	void shutdown(){
+		if(backgroundWorker){backgroundWorker->stop();}
+		if(prefetcher){prefetcher->stop();}
+		if(saveWorker){saveWorker->stop();}
+		if(placeholderTexture != NULL){SDL_DestroyTexture(placeholderTexture);}
+	}
+
+	void renderMarkers(SDL_Renderer* renderer){
+		std::vector<int> visible = getVisibleMarkers();
+		for(int i = 0; i < visible.size(); i++){
+			Marker* marker = &levels.at(currentLevel).markers.at(visible.at(i));
+			marker->addIcon(&iconBatch, &camera, getIconSource(marker->iconId));
+		}
+		profiler.addDrawCalls(iconBatch.flush(renderer, iconAtlas));
+
+		for(int i = 0; i < visible.size(); i++){
+			levels.at(currentLevel).markers.at(visible.at(i)).addLabel(&labelFont, &camera);
+		}
+		profiler.addDrawCalls(labelFont.flush(renderer));
+		profiler.addMarkersDrawn(visible.size());
+
+		if(isTyping && rightClickedMarkerIndex >= 0 && rightClickedMarkerIndex < levels.at(currentLevel).markers.size()){
+			levels.at(currentLevel).markers.at(rightClickedMarkerIndex).renderTextBox(renderer, &camera);
+			profiler.addDrawCalls(1);
+		}
 	}
 
 	bool isInsideIconScrolls(CoordInt pos){
@@ -1192,48 +3930,118 @@ struct Scene{
 	}
 
 	void clipCamera(){
+		if(levels.at(currentLevel).getWidth() <= 0){return;}
 		if(camera.position.x < 0){camera.position.x = 0;}
 		if(camera.position.y < 0){camera.position.y = 0;}
 
-		if(camera.width > levels.at(currentLevel).backgroundImage.cols){camera.width = levels.at(currentLevel).backgroundImage.cols;}
-		if(camera.height > levels.at(currentLevel).backgroundImage.rows){camera.height = levels.at(currentLevel).backgroundImage.rows;}
+		if(camera.width > levels.at(currentLevel).getWidth()){camera.width = levels.at(currentLevel).getWidth();}
+		if(camera.height > levels.at(currentLevel).getHeight()){camera.height = levels.at(currentLevel).getHeight();}
 
-		if(camera.position.x+camera.width > levels.at(currentLevel).backgroundImage.cols){
-			camera.position.x -= camera.position.x+camera.width-levels.at(currentLevel).backgroundImage.cols;
+		if(camera.position.x+camera.width > levels.at(currentLevel).getWidth()){
+			camera.position.x -= camera.position.x+camera.width-levels.at(currentLevel).getWidth();
 		}
-		if(camera.position.y+camera.height > levels.at(currentLevel).backgroundImage.rows){
+		if(camera.position.y+camera.height > levels.at(currentLevel).getHeight()){
 			LOG(currentLevel);
 			LOG(levels.size());
-			LOG(levels.at(currentLevel).backgroundImage.rows);
-			camera.position.y -= camera.position.y+camera.height-levels.at(currentLevel).backgroundImage.rows;
+			LOG(levels.at(currentLevel).getHeight());
+			camera.position.y -= camera.position.y+camera.height-levels.at(currentLevel).getHeight();
 		}
 	}
 
+	void renderProfilerOverlay(SDL_Renderer* renderer){
+		std::vector<std::string> lines = profiler.getReport();
+		int lineHeight = labelFont.getLineHeight() + LINE_SPACE;
+		int width = 0;
+		for(int i = 0; i < lines.size(); i++){
+			width = std::max(width, labelFont.measure(&lines.at(i)));
+		}
+		SDL_Rect rect = {camera.renderWidth - width - 2*LINE_SPACE, 0, width + 2*LINE_SPACE, (int)lines.size()*lineHeight + LINE_SPACE};
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+		SDL_RenderFillRect(renderer, &rect);
+		for(int i = 0; i < lines.size(); i++){
+			labelFont.addText(&lines.at(i), rect.x + LINE_SPACE, (i+1)*lineHeight, Color(255, 255, 255));
+		}
+		labelFont.flush(renderer);
+	}
+
+	void renderSaveStatus(SDL_Renderer* renderer){
+		int lineHeight = labelFont.getLineHeight() + LINE_SPACE;
+		SDL_Rect rect = {0, camera.renderHeight - lineHeight - LINE_SPACE, labelFont.measure(&saveStatus) + 2*LINE_SPACE, lineHeight + LINE_SPACE};
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+		SDL_RenderFillRect(renderer, &rect);
+		labelFont.addText(&saveStatus, rect.x + LINE_SPACE, rect.y + lineHeight, Color(255, 255, 255));
+		profiler.addDrawCalls(1 + labelFont.flush(renderer));
+	}
+
 	void render(){
+		profiler.begin();
 		renderBackground(w.renderer);
+		profiler.end(PHASE_BACKGROUND);
 		renderMarkers(w.renderer);
-		renderIconScrollComponents(w.renderer);
-		ColorRedScroll.render(w.renderer, iconTexture, &fallBackIcon, Color(ColorRedScroll.scrollIndex, 0, 0));
-		ColorGreenScroll.render(w.renderer, iconTexture, &fallBackIcon, Color(0, ColorGreenScroll.scrollIndex, 0));
-		ColorBlueScroll.render(w.renderer, iconTexture, &fallBackIcon, Color(0, 0, ColorBlueScroll.scrollIndex));
+		profiler.end(PHASE_MARKERS);
+		renderIconScrollComponents(&iconBatch);
+		ColorRedScroll.render(&iconBatch, fallBackIconRect, Color(ColorRedScroll.scrollIndex, 0, 0));
+		ColorGreenScroll.render(&iconBatch, fallBackIconRect, Color(0, ColorGreenScroll.scrollIndex, 0));
+		ColorBlueScroll.render(&iconBatch, fallBackIconRect, Color(0, 0, ColorBlueScroll.scrollIndex));
 
-		colorDisplayScroll.render(w.renderer, iconTexture, &fallBackIcon, Color(ColorRedScroll.scrollIndex, ColorGreenScroll.scrollIndex, ColorBlueScroll.scrollIndex));
+		colorDisplayScroll.render(&iconBatch, fallBackIconRect, Color(ColorRedScroll.scrollIndex, ColorGreenScroll.scrollIndex, ColorBlueScroll.scrollIndex));
+		profiler.addDrawCalls(iconBatch.flush(w.renderer, iconAtlas));
 
 		if(isLeftClickMenuActive){
-			lClickMenu.render(w.renderer, menuTexture);
+			profiler.addDrawCalls(lClickMenu.render(w.renderer, &menuFont));
+		}
+		profiler.end(PHASE_GUI);
+
+		if(!saveStatus.empty()){
+			renderSaveStatus(w.renderer);
+		}
+
+		if(profiler.isOverlayVisible){
+			renderProfilerOverlay(w.renderer);
+			profiler.begin();
 		}
 
 		SDL_RenderPresent(w.renderer);
+		profiler.end(PHASE_PRESENT);
+		profiler.endFrame();
+		isDirty = false;
 	}
 
 	void changeOutputResolution(int width, int height){
 		camera.renderWidth = width;
 		camera.renderHeight = height;
-		SDL_DestroyTexture(texture);
-		texture = SDL_CreateTexture(w.renderer, SDL_PIXELFORMAT_BGR24, SDL_TEXTUREACCESS_STATIC, camera.renderWidth, camera.renderHeight);
+		ensureBackgroundTexture();
 	}
 
 	void updateGUI(){
+		profiler.begin();
+		installPrefetchedLevels();
+		handleSaveResult();
+		if(isCompactionDue && !savePath.empty() && !saveWorker->isBusy()){
+			isCompactionDue = false;
+			saveData(false);
+		}
+		if(!saveStatus.empty() && SDL_GetTicks() - saveStatusTicks >= SAVE_STATUS_MS && !saveWorker->isBusy()){
+			saveStatus = "";
+			markDirty();
+		}
+		updateGUIState();
+		trackInteraction();
+		profiler.end(PHASE_UPDATE_GUI);
+	}
+
+	void trackInteraction(){
+		bool cameraMoved = camera.position.x != lastCamera.position.x || camera.position.y != lastCamera.position.y
+			|| camera.width != lastCamera.width || camera.height != lastCamera.height;
+		if(cameraMoved || isMarkerSelected){
+			lastInteractionTicks = SDL_GetTicks();
+		}
+		lastCamera = camera;
+	}
+
+	void updateGUIState(){
 		if(changedWindowSize){
 			alignCameraAspectRatio();
 			changedWindowSize = false;
@@ -1243,31 +4051,34 @@ struct Scene{
 			if(levels.at(currentLevel).parentId < 0){}
 			else{
 
-				currentLevel = levels.at(currentLevel).parentId;
-				resetGui();
+				openLevel(levels.at(currentLevel).parentId);
 			}
 			isUnhandledEscape = false;
 		}
 
-		if(isUnhandledRightMouseClick){
-			for(int i = 0; i < levels.at(currentLevel).markers.size(); i++){
-				if(levels.at(currentLevel).markers.at(i).isInside(mousePosition, &camera)){
-					lClickMenu.position = mousePosition;
-					if(levels.at(currentLevel).markers.at(i).levelLink < 0){
-						lClickMenu.options.at(2).isEnabled = true;
-						lClickMenu.options.at(3).isEnabled = false;
-					}else{
-						lClickMenu.options.at(2).isEnabled = false;
-						lClickMenu.options.at(3).isEnabled = true;
-					}
+		if(isUnhandledHover){
+			if(!isMouseLeftDown){prefetchMarkerLink(levels.at(currentLevel).getTopmostMarkerAt(mousePosition, &camera));}
+			isUnhandledHover = false;
+		}
 
-					isLeftClickMenuActive = true;
-					rightClickedMarkerIndex = i;
-					break;
-				}
-				if(i == levels.at(currentLevel).markers.size()-1){
-					isLeftClickMenuActive = false;
+		if(isUnhandledRightMouseClick){
+			int hit = levels.at(currentLevel).getTopmostMarkerAt(mousePosition, &camera);
+			if(hit >= 0){
+				lClickMenu.position = mousePosition;
+				if(levels.at(currentLevel).markers.at(hit).levelLink < 0){
+					lClickMenu.options.at(2).isEnabled = true;
+					lClickMenu.options.at(3).isEnabled = false;
+				}else{
+					lClickMenu.options.at(2).isEnabled = false;
+					lClickMenu.options.at(3).isEnabled = true;
 				}
+
+				isLeftClickMenuActive = true;
+				rightClickedMarkerIndex = hit;
+				prefetchMarkerLink(hit);
+			}
+			else{
+				isLeftClickMenuActive = false;
 			}
 			isUnhandledRightMouseClick = false;
 		}
@@ -1286,7 +4097,8 @@ struct Scene{
 
 			}
 			if(option == OPTION_DELETE){
-				levels.at(currentLevel).markers.erase(levels.at(currentLevel).markers.begin()+rightClickedMarkerIndex);
+				journalEdit(JournalRecord(JOURNAL_DELETE_MARKER, currentLevel, rightClickedMarkerIndex));
+				levels.at(currentLevel).removeMarker(rightClickedMarkerIndex);
 				rightClickedMarkerIndex = -1;
 			}			
 			if(option == OPTION_RENAME){
@@ -1296,12 +4108,16 @@ struct Scene{
 			}
 			if(option == OPTION_ADD_LEVEL){
 				int newLevelId = levels.size();
-				levels.push_back(Level(getImageFromUser(), currentLevel));
+				std::shared_ptr<EncodedImage> encodedImage;
+				cv::Mat image = getImageFromUser(&encodedImage);
+				addLevel(Level::fromImage(image, currentLevel, encodedImage));
 				levels.at(currentLevel).markers.at(rightClickedMarkerIndex).levelLink = newLevelId;
+				residency.enforce(&levels, currentLevel);
+				// The new level's image is not journaled, so adding a level forces a save instead.
+				isCompactionDue = true;
 			}
 			if(option == OPTION_OPEN_LEVEL){
-				currentLevel = levels.at(currentLevel).markers.at(rightClickedMarkerIndex).levelLink;
-				resetGui();
+				openLevel(levels.at(currentLevel).markers.at(rightClickedMarkerIndex).levelLink);
 			}
 			isLeftClickMenuActive = false;
 			isUnhandledLeftMouseClick = false;
@@ -1356,14 +4172,15 @@ struct Scene{
 			if(pt != NULL){
 				LOG("HERE 565")
 				addMarker(Marker(mousePosition, Color(ColorRedScroll.scrollIndex, ColorGreenScroll.scrollIndex, ColorBlueScroll.scrollIndex), Color(0, 0, 0), "new Marker", std::get<1>(marker_icons.at((*pt).scrollIndex)), 25));
-				selectedMarker = &(levels.at(currentLevel).markers.at(levels.at(currentLevel).markers.size() - 1));
+				selectedMarkerIndex = levels.at(currentLevel).markers.size() - 1;
 				isMarkerSelected = true;
+				journalNewMarker(currentLevel, selectedMarkerIndex);
 			}
 		}
 
 		
 		if(isMarkerSelected){
-			(*selectedMarker).position = camera.fromCameraCoordinates(mousePosition);
+			levels.at(currentLevel).moveMarker(selectedMarkerIndex, camera.fromCameraCoordinates(mousePosition));
 			isUnhandledLeftMouseClick = false;
 		}
 
@@ -1374,7 +4191,7 @@ struct Scene{
 		}
 
 		if(isSDown && isCTRLDown){
-			saveData();
+			saveData(isShiftDown);
 			isCTRLDown = false;
 			isSDown = false;
 		}